@@ -0,0 +1,127 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+// Measures how long config files take to evaluate and apply with the Lua
+// backend this was built against, see lua_backend.h.
+//
+//   ./benchmark [--iterations N] [--file F] [--max_instructions M]
+//
+// Each iteration evaluates the files in a fresh state, as a full reload does,
+// then applies the result to the CONFIG_* variables. A max_instructions of 0
+// runs without an instruction budget, which LuaJIT needs to JIT compile.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "config_reader/config_reader.h"
+
+CONFIG_VECTOR2FLIST(benchmark_waypoints, "benchmark_waypoints");
+CONFIG_DOUBLE(benchmark_length, "benchmark_length");
+CONFIG_DOUBLELIST(benchmark_curvature, "benchmark_curvature");
+CONFIG_FLOATLIST(benchmark_cost_grid, "benchmark_cost_grid");
+CONFIG_STRINGDOUBLEMAP(benchmark_segments, "benchmark_segments");
+
+namespace {
+
+struct Options {
+  int iterations;
+  std::string file;
+  size_t max_instructions;
+
+  Options()
+      : iterations(20),
+        file("benchmark_config.lua"),
+        max_instructions(config_reader::kDefaultMaxInstructions) {}
+};
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string flag = argv[i];
+    const char* value = argv[i + 1];
+    if (flag == "--iterations") {
+      options->iterations = atoi(value);
+    } else if (flag == "--file") {
+      options->file = value;
+    } else if (flag == "--max_instructions") {
+      options->max_instructions = strtoull(value, nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return argc % 2 == 1 && options->iterations > 0;
+}
+
+double Milliseconds(const std::chrono::steady_clock::duration& duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Median, min and max of the samples, in milliseconds.
+std::string Summarize(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  return "median " + std::to_string(samples[samples.size() / 2]) + ", min " +
+         std::to_string(samples.front()) + ", max " +
+         std::to_string(samples.back());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--iterations N] [--file F] [--max_instructions M]"
+              << std::endl;
+    return 1;
+  }
+  config_reader::ScriptLimits limits;
+  limits.max_instructions = options.max_instructions;
+
+  std::vector<double> evaluate_ms;
+  std::vector<double> apply_ms;
+  // The first iteration only warms up.
+  for (int i = 0; i <= options.iterations; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    config_reader::LuaScript script({options.file}, limits);
+    const auto evaluated = std::chrono::steady_clock::now();
+    if (!config_reader::LuaRead(&script)) {
+      return 1;
+    }
+    const auto applied = std::chrono::steady_clock::now();
+    if (i > 0) {
+      evaluate_ms.push_back(Milliseconds(evaluated - start));
+      apply_ms.push_back(Milliseconds(applied - evaluated));
+    }
+  }
+
+  std::cout << "backend: " << config_reader::lua_backend::kName << std::endl;
+  std::cout << "file: " << options.file << ", iterations: "
+            << options.iterations << ", instruction budget: "
+            << (options.max_instructions > 0 ? "on" : "off") << std::endl;
+  std::cout << "evaluate (ms): " << Summarize(evaluate_ms) << std::endl;
+  std::cout << "apply (ms): " << Summarize(apply_ms) << std::endl;
+  std::cout << "waypoints: " << CONFIG_benchmark_waypoints.size()
+            << ", length: " << CONFIG_benchmark_length
+            << ", segments: " << CONFIG_benchmark_segments.size() << std::endl;
+  return 0;
+}
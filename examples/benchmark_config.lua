@@ -0,0 +1,72 @@
+-- A computationally heavy config, for benchmark.cc: a generated trajectory,
+-- geometry derived from it and a precomputed cost grid. Runs unchanged on
+-- Lua 5.2, Lua 5.4 and LuaJIT.
+
+local kWaypoints = 20000
+local kGridSize = 120
+
+local function Smoothstep(t)
+  return t * t * (3 - 2 * t)
+end
+
+-- A figure eight with a wobble, sampled at kWaypoints points.
+benchmark_waypoints = {}
+local length = 0
+for i = 1, kWaypoints do
+  local t = (i - 1) / (kWaypoints - 1)
+  local s = Smoothstep(t)
+  local x = 10 * math.cos(2 * math.pi * s) + 0.5 * math.sin(14 * math.pi * t)
+  local y = 6 * math.sin(4 * math.pi * s)
+  if i > 1 then
+    local previous = benchmark_waypoints[i - 1]
+    length = length + math.sqrt((x - previous[1]) ^ 2 + (y - previous[2]) ^ 2)
+  end
+  benchmark_waypoints[i] = {x, y}
+end
+benchmark_length = length
+
+-- Curvature at every waypoint, from the circle through it and its
+-- neighbours.
+benchmark_curvature = {0}
+for i = 2, kWaypoints - 1 do
+  local a = benchmark_waypoints[i - 1]
+  local b = benchmark_waypoints[i]
+  local c = benchmark_waypoints[i + 1]
+  local cross = (b[1] - a[1]) * (c[2] - a[2]) - (b[2] - a[2]) * (c[1] - a[1])
+  local ab = math.sqrt((b[1] - a[1]) ^ 2 + (b[2] - a[2]) ^ 2)
+  local bc = math.sqrt((c[1] - b[1]) ^ 2 + (c[2] - b[2]) ^ 2)
+  local ca = math.sqrt((a[1] - c[1]) ^ 2 + (a[2] - c[2]) ^ 2)
+  local denominator = ab * bc * ca
+  benchmark_curvature[i] = denominator > 0 and 2 * cross / denominator or 0
+end
+benchmark_curvature[kWaypoints] = 0
+
+-- Cost of each grid cell: distance to the nearest of every 100th waypoint.
+benchmark_cost_grid = {}
+for row = 1, kGridSize do
+  for column = 1, kGridSize do
+    local x = -12 + 24 * (column - 1) / (kGridSize - 1)
+    local y = -8 + 16 * (row - 1) / (kGridSize - 1)
+    local nearest = math.huge
+    for i = 1, kWaypoints, 100 do
+      local p = benchmark_waypoints[i]
+      local d = (p[1] - x) ^ 2 + (p[2] - y) ^ 2
+      if d < nearest then
+        nearest = d
+      end
+    end
+    benchmark_cost_grid[#benchmark_cost_grid + 1] = math.sqrt(nearest)
+  end
+end
+
+-- Named segments of the trajectory, with their lengths.
+benchmark_segments = {}
+for i = 1, kWaypoints - 100, 100 do
+  local segment = 0
+  for j = i, i + 99 do
+    local a = benchmark_waypoints[j]
+    local b = benchmark_waypoints[j + 1]
+    segment = segment + math.sqrt((b[1] - a[1]) ^ 2 + (b[2] - a[2]) ^ 2)
+  end
+  benchmark_segments[string.format("segment_%05d", i)] = segment
+end
@@ -0,0 +1,195 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+// Measures what independent configs cost as their number grows, with every
+// context of a ConfigGroup loading one shared file plus a small file of its
+// own, as in a simulator running many robots in one process.
+//
+//   ./benchmark_contexts [--contexts N] [--parameters P] [--max_instructions M]
+//
+// For 1, 2, 4, ... N contexts it reports the memory they add, the time to
+// load them, and the time to reload them all after the shared file changes.
+// The shared file is generated with P parameter tables, so its cost is mostly
+// parsing, which the contexts share.
+#include <poll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "config_reader/config_group.h"
+
+namespace {
+
+using config_reader::config_types::ConfigDouble;
+using config_reader::config_types::ConfigInt;
+using config_reader::config_types::ConfigIntList;
+
+struct Options {
+  int contexts;
+  int parameters;
+  size_t max_instructions;
+
+  Options()
+      : contexts(64),
+        parameters(5000),
+        max_instructions(config_reader::kDefaultMaxInstructions) {}
+};
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string flag = argv[i];
+    const char* value = argv[i + 1];
+    if (flag == "--contexts") {
+      options->contexts = atoi(value);
+    } else if (flag == "--parameters") {
+      options->parameters = atoi(value);
+    } else if (flag == "--max_instructions") {
+      options->max_instructions = strtoull(value, nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return argc % 2 == 1 && options->contexts > 0 && options->parameters > 0;
+}
+
+double Milliseconds(const std::chrono::steady_clock::duration& duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Resident set size of the process, in MiB.
+double ResidentMiB() {
+  std::ifstream statm("/proc/self/statm");
+  size_t total_pages = 0;
+  size_t resident_pages = 0;
+  statm >> total_pages >> resident_pages;
+  return resident_pages * static_cast<double>(sysconf(_SC_PAGESIZE)) /
+         (1 << 20);
+}
+
+void WriteCommon(const std::string& path, const int parameters,
+                 const int version) {
+  std::ofstream file(path);
+  file << "-- Version " << version << "\n";
+  for (int i = 0; i < parameters; ++i) {
+    file << "param_" << i << " = { gain = " << i << " * 0.5; limits = {-" << i
+         << ", " << i << "}; name = \"param_" << i << "\"; };\n";
+  }
+}
+
+// One simulated robot: its registry and the variables bound in it.
+struct Robot {
+  config_reader::Registry registry;
+  const int* id;
+  const double* speed;
+  const std::vector<int>* limits;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--contexts N] [--parameters P] [--max_instructions M]"
+              << std::endl;
+    return 1;
+  }
+  const std::string common = "/tmp/config_reader_benchmark_common.lua";
+  int version = 0;
+  WriteCommon(common, options.parameters, version);
+  std::vector<std::string> robot_files;
+  for (int i = 0; i < options.contexts; ++i) {
+    robot_files.push_back("/tmp/config_reader_benchmark_robot_" +
+                          std::to_string(i) + ".lua");
+    std::ofstream file(robot_files.back());
+    file << "robot_id = " << i << "\nrobot_speed = param_7.gain * " << i
+         << "\nrobot_limits = param_" << i % options.parameters
+         << ".limits\n";
+  }
+
+  std::cout << "backend: " << config_reader::lua_backend::kName << std::endl;
+  std::cout << "parameters: " << options.parameters
+            << ", instruction budget: "
+            << (options.max_instructions > 0 ? "on" : "off") << std::endl;
+  std::cout << "contexts  added MiB  MiB each  load ms  reload ms  "
+               "reload ms each  files parsed"
+            << std::endl;
+  for (int count = 1; count <= options.contexts; count *= 2) {
+    const double resident_before = ResidentMiB();
+    config_reader::ConfigGroupOptions group_options;
+    group_options.script_limits.max_instructions = options.max_instructions;
+    group_options.threadless = true;
+    config_reader::ConfigGroup group(group_options);
+    std::vector<std::unique_ptr<Robot>> robots;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+      robots.emplace_back(new Robot());
+      Robot& robot = *robots.back();
+      robot.id = &robot.registry.Bind<ConfigInt>("robot_id");
+      robot.speed = &robot.registry.Bind<ConfigDouble>("robot_speed");
+      robot.limits = &robot.registry.Bind<ConfigIntList>("robot_limits");
+      if (!group.AddContext(&robot.registry, {common, robot_files[i]})) {
+        return 1;
+      }
+    }
+    const double load_ms =
+        Milliseconds(std::chrono::steady_clock::now() - start);
+    const double added_mib = ResidentMiB() - resident_before;
+
+    WriteCommon(common, options.parameters, ++version);
+    pollfd ready_to_read = {};
+    ready_to_read.fd = group.fd();
+    ready_to_read.events = POLLIN;
+    double reload_ms = 0;
+    size_t reloaded = 0;
+    while (reloaded < static_cast<size_t>(count)) {
+      if (poll(&ready_to_read, 1, 1000) <= 0) {
+        std::cerr << "No reload after changing " << common << std::endl;
+        return 1;
+      }
+      group.ProcessEvents();
+      const auto reload_start = std::chrono::steady_clock::now();
+      reloaded += group.ApplyPending();
+      reload_ms +=
+          Milliseconds(std::chrono::steady_clock::now() - reload_start);
+    }
+    if (*robots.back()->id != count - 1 ||
+        *robots.back()->speed != 3.5 * (count - 1) ||
+        robots.back()->limits->size() != 2) {
+      std::cerr << "Wrong values loaded" << std::endl;
+      return 1;
+    }
+
+    char line[128];
+    snprintf(line, sizeof(line), "%8d %10.1f %9.2f %8.1f %10.1f %15.2f %13zu",
+             count, added_mib, added_mib / count, load_ms, reload_ms,
+             reload_ms / count, group.Chunks().Compiled());
+    std::cout << line << std::endl;
+  }
+  return 0;
+}
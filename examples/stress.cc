@@ -0,0 +1,303 @@
+// Copyright 2020 Kyle Vedder (kvedder@seas.upenn.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+// Measures what a high rate reader loop sees while the config daemon reloads:
+// read latency percentiles, generations the readers never saw, and reads
+// that observed a half applied reload.
+//
+//   ./stress [--readers N] [--seconds S] [--writes_per_second R]
+//            [--rename_every K]
+//
+// A writer rewrites the config file R times a second, replacing it through a
+// rename on every K-th write (0 for never) the way many editors save.
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config_reader/config_reader.h"
+
+CONFIG_INT(stress_generation, "stress_generation");
+CONFIG_INT(stress_check, "stress_check");
+CONFIG_VECTOR3F(stress_vector, "stress_vector");
+
+namespace {
+
+static constexpr char kConfigFile[] = "/tmp/config_reader_stress.lua";
+static constexpr char kTempFile[] = "/tmp/config_reader_stress.lua.tmp";
+// Generations are checked with stress_check = kCheckFactor * generation.
+static constexpr int kCheckFactor = 7;
+// Latencies below this are counted in 1 ns buckets, longer ones in
+// power of two buckets.
+static constexpr size_t kLinearBuckets = 4096;
+static constexpr size_t kLogBuckets = 64;
+
+struct Options {
+  int readers;
+  int seconds;
+  double writes_per_second;
+  int rename_every;
+
+  Options()
+      : readers(4), seconds(5), writes_per_second(20), rename_every(2) {}
+};
+
+class Histogram {
+  std::vector<uint64_t> linear_;
+  std::vector<uint64_t> log_;
+  uint64_t count_;
+  uint64_t max_;
+
+  static size_t Log2(uint64_t value) {
+    size_t bits = 0;
+    while (value >>= 1) {
+      ++bits;
+    }
+    return bits;
+  }
+
+ public:
+  Histogram()
+      : linear_(kLinearBuckets, 0), log_(kLogBuckets, 0), count_(0), max_(0) {}
+
+  void Add(const uint64_t nanoseconds) {
+    if (nanoseconds < kLinearBuckets) {
+      ++linear_[nanoseconds];
+    } else {
+      ++log_[Log2(nanoseconds)];
+    }
+    ++count_;
+    max_ = std::max(max_, nanoseconds);
+  }
+
+  void Merge(const Histogram& other) {
+    for (size_t i = 0; i < kLinearBuckets; ++i) {
+      linear_[i] += other.linear_[i];
+    }
+    for (size_t i = 0; i < kLogBuckets; ++i) {
+      log_[i] += other.log_[i];
+    }
+    count_ += other.count_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  // Upper bound of the bucket holding the given fraction of samples.
+  uint64_t Percentile(const double fraction) const {
+    const uint64_t target = static_cast<uint64_t>(fraction * count_);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kLinearBuckets; ++i) {
+      seen += linear_[i];
+      if (seen > target) {
+        return i;
+      }
+    }
+    for (size_t i = 0; i < kLogBuckets; ++i) {
+      seen += log_[i];
+      if (seen > target) {
+        return std::min(max_, (uint64_t{2} << i) - 1);
+      }
+    }
+    return max_;
+  }
+
+  uint64_t Count() const { return count_; }
+  uint64_t Max() const { return max_; }
+};
+
+struct ReaderStats {
+  Histogram latency;
+  // Generations this reader saw, indexed by generation.
+  std::vector<bool> seen;
+  // Reads where keys from two different generations were seen together.
+  uint64_t torn_across_keys;
+  // Reads where one value was partly from two generations.
+  uint64_t torn_within_value;
+
+  ReaderStats() : torn_across_keys(0), torn_within_value(0) {}
+};
+
+std::string ConfigText(const int generation) {
+  const std::string g = std::to_string(generation);
+  return "stress_generation = " + g + "\n" +
+         "stress_check = " + std::to_string(kCheckFactor * generation) + "\n" +
+         "stress_vector = {" + g + ", " + g + ", " + g + "}\n";
+}
+
+void WriteConfig(const int generation, const bool rename_save) {
+  const char* path = rename_save ? kTempFile : kConfigFile;
+  {
+    std::ofstream file(path);
+    file << ConfigText(generation);
+  }
+  if (rename_save && rename(kTempFile, kConfigFile) != 0) {
+    perror("rename");
+  }
+}
+
+void Pin(const int cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    std::cerr << "Couldn't pin a reader to CPU " << cpu << std::endl;
+  }
+}
+
+void Reader(const int cpu, const int max_generation,
+            const std::atomic_bool* running, ReaderStats* stats) {
+  Pin(cpu);
+  stats->seen.assign(max_generation + 1, false);
+  while (*running) {
+    const auto start = std::chrono::steady_clock::now();
+    const int generation = CONFIG_stress_generation;
+    const int check = CONFIG_stress_check;
+    const Eigen::Vector3f vector = CONFIG_stress_vector;
+    const int generation_after = CONFIG_stress_generation;
+    const auto end = std::chrono::steady_clock::now();
+    stats->latency.Add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+
+    if (vector.x() != vector.y() || vector.y() != vector.z()) {
+      ++stats->torn_within_value;
+    } else if (generation == generation_after &&
+               (check != kCheckFactor * generation ||
+                vector.x() != static_cast<float>(generation))) {
+      ++stats->torn_across_keys;
+    }
+    if (generation >= 0 && generation <= max_generation) {
+      stats->seen[generation] = true;
+    }
+  }
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string flag = argv[i];
+    const char* value = argv[i + 1];
+    if (flag == "--readers") {
+      options->readers = atoi(value);
+    } else if (flag == "--seconds") {
+      options->seconds = atoi(value);
+    } else if (flag == "--writes_per_second") {
+      options->writes_per_second = atof(value);
+    } else if (flag == "--rename_every") {
+      options->rename_every = atoi(value);
+    } else {
+      return false;
+    }
+  }
+  return argc % 2 == 1 && options->readers > 0 && options->seconds > 0 &&
+         options->writes_per_second > 0 && options->rename_every >= 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--readers N] [--seconds S] [--writes_per_second R]"
+                 " [--rename_every K]"
+              << std::endl;
+    return 1;
+  }
+  const int max_generation = static_cast<int>(
+      options.seconds * options.writes_per_second + 1);
+  const int num_cpus =
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+  WriteConfig(0, false);
+  config_reader::ConfigReader reader({kConfigFile});
+
+  std::atomic_bool running(true);
+  std::vector<ReaderStats> stats(options.readers);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < options.readers; ++i) {
+    readers.emplace_back(&Reader, i % num_cpus, max_generation, &running,
+                         &stats[i]);
+  }
+
+  // Writer
+  const auto period = std::chrono::duration<double>(
+      1.0 / options.writes_per_second);
+  const auto start = std::chrono::steady_clock::now();
+  int generation = 0;
+  int renames = 0;
+  while (generation < max_generation &&
+         std::chrono::steady_clock::now() - start <
+             std::chrono::seconds(options.seconds)) {
+    std::this_thread::sleep_until(start + (generation + 1) * period);
+    ++generation;
+    const bool rename_save = options.rename_every > 0 &&
+                             generation % options.rename_every == 0;
+    renames += rename_save;
+    WriteConfig(generation, rename_save);
+  }
+
+  // Give the daemon time to pick up the last write.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  running = false;
+  for (std::thread& t : readers) {
+    t.join();
+  }
+
+  Histogram latency;
+  std::vector<bool> seen(max_generation + 1, false);
+  uint64_t torn_across_keys = 0;
+  uint64_t torn_within_value = 0;
+  for (const ReaderStats& s : stats) {
+    latency.Merge(s.latency);
+    torn_across_keys += s.torn_across_keys;
+    torn_within_value += s.torn_within_value;
+    for (size_t g = 0; g < s.seen.size(); ++g) {
+      seen[g] = seen[g] || s.seen[g];
+    }
+  }
+  const int applied = std::count(seen.begin() + 1,
+                                 seen.begin() + generation + 1, true);
+
+  std::cout << "readers: " << options.readers
+            << ", writes: " << generation << " (" << renames
+            << " by rename)" << std::endl;
+  std::cout << "reads: " << latency.Count() << std::endl;
+  std::cout << "read latency (ns): p50 " << latency.Percentile(0.5)
+            << ", p99 " << latency.Percentile(0.99) << ", p99.9 "
+            << latency.Percentile(0.999) << ", max " << latency.Max()
+            << std::endl;
+  std::cout << "generations seen: " << applied << " of " << generation
+            << ", missed updates: " << generation - applied << std::endl;
+  std::cout << "torn reads: " << torn_across_keys << " across keys, "
+            << torn_within_value << " within a value" << std::endl;
+  std::cout << "last write applied: "
+            << (CONFIG_stress_generation == generation ? "yes" : "no")
+            << std::endl;
+  remove(kConfigFile);
+  return 0;
+}
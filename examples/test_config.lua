@@ -15,3 +15,38 @@ another = {
   sample_vector2f_list = {{9.1, 2.3}, {4.5, 6.7}};
 };
 };
+
+gains = {
+  kp = 1.5;
+  ki = 0.25;
+  limits = {-1, 1};
+  name = "pid";
+};
+
+bad_gains = {
+  kp = 2.0;
+  ki = "not a number";
+  limits = {};
+  name = "bad";
+};
+
+robot_speeds = {
+  alpha = 1.5;
+  beta = 2.5;
+  ["gamma-3"] = 3.5;
+};
+
+sensor_names = {
+  [1] = "lidar";
+  [7] = "camera";
+  [42] = "imu";
+};
+
+grid = {
+  file = "test_grid.npy";
+  shape = {2, 3};
+};
+wrong_shape_grid = {
+  file = "test_grid.npy";
+  shape = {3, 2};
+};
@@ -0,0 +1,8 @@
+-- Never terminates and grows without bound; must be cut off by ScriptLimits.
+seven = 8;
+runaway = {};
+local i = 1;
+while true do
+  runaway[i] = i;
+  i = i + 1;
+end
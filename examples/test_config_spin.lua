@@ -0,0 +1,7 @@
+-- Never terminates or allocates, so only the instruction budget can stop it,
+-- even under a JIT compiler.
+seven = 8;
+local i = 0;
+while true do
+  i = i + 1;
+end
@@ -18,10 +18,34 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 // ========================================================================
+#include <dirent.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
 #include <csignal>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
 
+#include "config_reader/config_group.h"
 #include "config_reader/config_reader.h"
+#include "config_reader/validation.h"
+
+struct Gains {
+  double kp;
+  float ki;
+  std::vector<int> limits;
+  std::string name;
+};
+REFLECT_CONFIG_STRUCT(Gains, kp, ki, limits, name);
 
 void Check(const bool statement) {
   if (!statement) {
@@ -35,6 +59,718 @@ int MyFunction() {
   return CONFIG_twelve;
 }
 
+void TestScriptLimits() {
+  CONFIG_INT(seven, "seven");
+  // Instruction budget exhausted long before memory.
+  Check(!config_reader::LuaRead({"test_config_runaway.lua"},
+                                config_reader::ScriptLimits(1000000, 1 << 30)));
+  Check(CONFIG_seven == 7);
+  Check(!config_reader::LuaRead({"test_config_spin.lua"},
+                                config_reader::ScriptLimits(1000000, 1 << 30)));
+  Check(CONFIG_seven == 7);
+  // Memory cap hit long before the instruction budget.
+  Check(!config_reader::LuaRead({"test_config_runaway.lua"},
+                                config_reader::ScriptLimits(1 << 30, 1 << 20)));
+  Check(CONFIG_seven == 7);
+  // A cap smaller than the standard libraries fails the load rather than
+  // aborting the process. LuaJIT may not be able to cap memory at all.
+  {
+    std::ofstream file("/tmp/config_reader_tests_tiny.lua");
+    file << "tiny = {1, 2, 3}\n";
+  }
+  config_reader::LuaScript tiny({"/tmp/config_reader_tests_tiny.lua"},
+                                config_reader::ScriptLimits(1 << 30, 1024));
+  Check(!tiny.IsLoaded() ||
+        std::string(config_reader::lua_backend::kName).find("LuaJIT") == 0);
+  // Errors need not be strings.
+  {
+    std::ofstream file("/tmp/config_reader_tests_raise.lua");
+    file << "error({})\n";
+  }
+  config_reader::LuaScript raise({"/tmp/config_reader_tests_raise.lua"});
+  Check(!raise.IsLoaded());
+}
+
+void TestSnapshot() {
+  CONFIG_INT(seven, "seven");
+  CONFIG_STRUCT(gains, "gains", Gains);
+  CONFIG_STRINGDOUBLEMAP(robot_speeds, "robot_speeds");
+  config_reader::LuaScript script({"test_config.lua"});
+  std::string snapshot;
+  Check(script.SerializeGlobals(&snapshot));
+
+  std::string error;
+  config_reader::SnapshotPublisher publisher;
+  Check(publisher.Open("/config_reader_tests", 1 << 20, &error));
+  Check(publisher.Publish(snapshot, &error));
+  config_reader::SnapshotSubscriber subscriber;
+  Check(subscriber.Open("/config_reader_tests", &error));
+  uint64_t generation = 0;
+  std::string received;
+  Check(subscriber.Read(&generation, &received));
+  Check(received == snapshot);
+  Check(!subscriber.Read(&generation, &received));
+
+  Check(config_reader::SnapshotRead(
+      "seven = 9\ngains = {kp = 3, ki = 1, limits = {}, name = \"x\"}\n"));
+  Check(CONFIG_seven == 9);
+  Check(CONFIG_gains.kp == 3);
+  Check(config_reader::SnapshotRead(received));
+  Check(CONFIG_seven == 7);
+  Check(CONFIG_gains.kp == 1.5);
+  Check(CONFIG_gains.limits == std::vector<int>({-1, 1}));
+  Check(*CONFIG_robot_speeds.Find("gamma-3") == 3.5);
+
+  // Numbers in text must fit the type exactly.
+  int parsed_int = 0;
+  unsigned int parsed_uint = 0;
+  float parsed_float = 0;
+  Check(!config_reader::text::FromText("1e300", &parsed_int, &error));
+  Check(!config_reader::text::FromText("inf", &parsed_int, &error));
+  Check(!config_reader::text::FromText("2.5", &parsed_int, &error));
+  Check(!config_reader::text::FromText("2147483648", &parsed_int, &error));
+  Check(config_reader::text::FromText("-2147483648", &parsed_int, &error) &&
+        parsed_int == -2147483647 - 1);
+  Check(!config_reader::text::FromText("-1", &parsed_uint, &error));
+  Check(!config_reader::text::FromText("1e300", &parsed_float, &error));
+  Check(config_reader::text::FromText("2.5", &parsed_float, &error) &&
+        parsed_float == 2.5f);
+
+  // Nesting is limited, rather than recursed into until the stack overflows.
+  const std::string deep = std::string(1000000, '{');
+  Check(!config_reader::SnapshotRead("seven = 7\nx = " + deep + "\n"));
+  Check(config_reader::SnapshotRead("x = {{{1}}}\nseven = 7\n"));
+}
+
+void TestGenerationHistory() {
+  CONFIG_INT(seven, "seven");
+  config_reader::GenerationHistory history(2);
+  Check(history.LatestId() == 0);
+  Check(history.Record({{"a.lua", 1}}, "seven = 1\n") == 1);
+  Check(history.Record({{"a.lua", 2}}, "seven = 2\n") == 2);
+  Check(history.Record({{"a.lua", 3}}, "seven = 3\n") == 3);
+  config_reader::ConfigGeneration generation;
+  Check(!history.Get(1, &generation));
+  Check(history.Get(2, &generation));
+  Check(generation.snapshot == "seven = 2\n");
+  Check(history.GetAll().size() == 2);
+  Check(history.GetAt(generation.monotonic_ns, &generation));
+  Check(generation.id == 2);
+  Check(!history.GetAt(generation.monotonic_ns - 1, &generation));
+
+  Check(history.Get(3, &generation));
+  const std::string exported = config_reader::ExportGeneration(generation);
+  config_reader::ConfigGeneration imported;
+  std::string error;
+  Check(config_reader::ImportGeneration(exported, &imported, &error));
+  Check(imported.id == 3);
+  Check(imported.monotonic_ns == generation.monotonic_ns);
+  Check(imported.file_hashes == generation.file_hashes);
+  Check(imported.snapshot == generation.snapshot);
+  Check(config_reader::SnapshotRead(exported));
+  Check(CONFIG_seven == 3);
+  Check(config_reader::SnapshotRead("seven = 7\n"));
+}
+
+void TestProfile() {
+  // Declared as usual. Reads are only counted with CONFIG_READER_PROFILE,
+  // and the members of each type read the same either way.
+  CONFIG_INT(profiled_seven, "seven");
+  CONFIG_STRUCT(profiled_gains, "gains", Gains);
+  CONFIG_VECTOR2F(profiled_vector2f, "sample_vector2f");
+  CONFIG_INTLIST(profiled_int_list, "int_list");
+  CONFIG_INT(profiled_unrelated, "unrelated");
+  (void)CONFIG_profiled_unrelated;  // Named, but never read.
+  config_reader::LuaRead({"test_config.lua"});
+  Check(CONFIG_profiled_gains.kp == 1.5);
+  Check(CONFIG_profiled_gains.name == "pid");
+  Check(CONFIG_profiled_gains.limits.at(1) == 1);
+  Check(CONFIG_profiled_vector2f.x() == 1.2f);
+  Check(CONFIG_profiled_int_list.at(0) == CONFIG_profiled_int_list[0]);
+  int sum = 0;
+  for (int i = 0; i < 100000; ++i) {
+    sum += CONFIG_profiled_seven;
+  }
+  Check(sum == 700000);
+  uint64_t reads = 0;
+  bool gains_read = false;
+  for (const auto& site : config_reader::ProfileSites()) {
+    if (site.key == "seven") {
+      Check(site.read);
+      reads += site.estimated_reads;
+    }
+    gains_read = gains_read || (site.key == "gains" && site.read);
+  }
+
+  // Other registries' keys are profiled separately.
+  config_reader::Registry registry;
+  registry.Bind<config_reader::config_types::ConfigInt>("other");
+  const std::vector<config_reader::KeyProfile> other =
+      config_reader::ProfileKeys(&registry);
+  Check(other.size() == 1 && other[0].key == "other" && !other[0].read);
+  std::ostringstream other_dump;
+  config_reader::DumpProfile(other_dump, 20, &registry);
+  Check(other_dump.str().find("seven") == std::string::npos);
+
+  if (!config_reader::kProfilingEnabled) {
+    Check(reads == 0 && !gains_read);
+    return;
+  }
+  Check(reads > 50000 && reads < 150000);
+  Check(gains_read);
+  const std::vector<config_reader::KeyProfile> keys =
+      config_reader::ProfileKeys();
+  Check(keys.front().key == "seven");
+  Check(std::find_if(keys.begin(), keys.end(),
+                     [](const config_reader::KeyProfile& key) {
+                       return key.key == "unrelated" && !key.read;
+                     }) != keys.end());
+  std::ostringstream dump;
+  config_reader::DumpProfile(dump);
+  Check(dump.str().find("seven") != std::string::npos);
+}
+
+void WriteFile(const std::string& path, const std::string& contents) {
+  std::ofstream file(path);
+  file << contents;
+}
+
+void TestPartialReload() {
+  const std::string base = "/tmp/config_reader_tests_base.lua";
+  const std::string derived = "/tmp/config_reader_tests_derived.lua";
+  const std::string leaf = "/tmp/config_reader_tests_leaf.lua";
+  WriteFile(base, "base = 2\nshared = {x = 1}\n");
+  WriteFile(derived, "derived = base * 3\nshared.y = 5\n");
+  WriteFile(leaf, "leaf = 4\n");
+  config_reader::LuaScript script({base, derived, leaf});
+  Check(script.IsLoaded());
+  Check(script.FilesEvaluated() == 3);
+  const std::vector<std::string> locations;
+
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 0);
+
+  WriteFile(leaf, "leaf = 5\n");
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 1);
+  Check(script.GetVariable<int>("leaf", locations).second == 5);
+
+  // derived reads base, and adds to the table base defines.
+  WriteFile(base, "base = 3\nshared = {x = 1}\n");
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 2);
+  Check(script.GetVariable<int>("derived", locations).second == 9);
+  Check(script.GetVariable<int>("shared.y", locations).second == 5);
+
+  WriteFile(derived, "derived = base * 4\n");
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 2);
+  Check(script.GetVariable<int>("derived", locations).second == 12);
+  Check(!script.GetVariable<int>("shared.y", locations).first);
+
+  // A global read before a later file defines it forces a full evaluation.
+  WriteFile(base, "base = leaf or 1\nshared = {}\n");
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 3);
+  Check(script.GetVariable<int>("base", locations).second == 1);
+
+  WriteFile(leaf, "leaf = (\n");
+  Check(!script.Update());
+  WriteFile(leaf, "leaf = 6\n");
+  Check(script.Update());
+  Check(script.GetVariable<int>("leaf", locations).second == 6);
+
+  // _G is the real globals table. What a file does through it isn't
+  // tracked, so any change then evaluates every file.
+  WriteFile(derived, "derived = rawget(_G, \"base\") * 4\n"
+                     "count = 0\n"
+                     "for name in pairs(_G) do\n"
+                     "  if name == \"base\" then count = count + 1 end\n"
+                     "end\n"
+                     "rawset(_G, \"raw\", 8)\n");
+  Check(script.Update());
+  Check(script.GetVariable<int>("derived", locations).second == 4);
+  Check(script.GetVariable<int>("count", locations).second == 1);
+  Check(script.GetVariable<int>("raw", locations).second == 8);
+  WriteFile(leaf, "leaf = 7\n");
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 3);
+  Check(script.GetVariable<int>("raw", locations).second == 8);
+}
+
+void TestIncludes() {
+  const std::string shared = "/tmp/config_reader_tests_shared.lua";
+  const std::string module = "/tmp/config_reader_tests_module.lua";
+  const std::string a = "/tmp/config_reader_tests_includes_a.lua";
+  const std::string b = "/tmp/config_reader_tests_includes_b.lua";
+  const std::string c = "/tmp/config_reader_tests_includes_c.lua";
+  WriteFile(shared, "shared_gain = 2\n");
+  WriteFile(module, "return {scale = 10}\n");
+  WriteFile(a, "dofile(\"" + shared + "\")\n"
+               "package.path = \"/tmp/?.lua;\" .. package.path\n"
+               "local m = require(\"config_reader_tests_module\")\n"
+               "included_a = shared_gain * m.scale\n");
+  WriteFile(b, "local f = loadfile(\"" + shared + "\")\nf()\n"
+               "included_b = shared_gain +\n"
+               "    require(\"config_reader_tests_module\").scale\n");
+  WriteFile(c, "included_c = 1\n");
+  std::shared_ptr<config_reader::ChunkCache> chunks(
+      new config_reader::ChunkCache());
+  config_reader::LuaScript script({a, b, c}, config_reader::ScriptLimits(),
+                                  chunks);
+  Check(script.IsLoaded());
+  const std::vector<std::string> locations;
+  Check(script.GetVariable<int>("included_a", locations).second == 20);
+  Check(script.GetVariable<int>("included_b", locations).second == 12);
+  Check(script.IncludedFiles() == std::vector<std::string>({module, shared}));
+  const std::vector<std::string>& watched = script.WatchedFiles();
+  Check(std::count(watched.begin(), watched.end(), shared) == 1);
+  Check(std::count(watched.begin(), watched.end(), module) == 1);
+  // The three files, and each included file once.
+  Check(chunks->Compiled() == 5);
+  Check(chunks->Reused() == 1);
+
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 0);
+
+  WriteFile(module, "return {scale = 100}\n");
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 2);
+  Check(script.GetVariable<int>("included_a", locations).second == 200);
+  Check(script.GetVariable<int>("included_b", locations).second == 102);
+
+  WriteFile(shared, "shared_gain = 3\n");
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 2);
+  Check(script.GetVariable<int>("included_a", locations).second == 300);
+
+  WriteFile(c, "included_c = 2\n");
+  Check(script.Update());
+  Check(script.FilesEvaluated() == 1);
+
+  // A reader reloads when an included file changes.
+  CONFIG_INT(included_a, "included_a");
+  config_reader::ConfigReaderOptions options;
+  options.threadless = true;
+  config_reader::ConfigReader reader({a}, options);
+  Check(CONFIG_included_a == 300);
+  WriteFile(shared, "shared_gain = 4\n");
+  pollfd ready_to_read = {};
+  ready_to_read.fd = reader.fd();
+  ready_to_read.events = POLLIN;
+  for (int i = 0; i < 100 && CONFIG_included_a != 400; ++i) {
+    if (poll(&ready_to_read, 1, 50) > 0) {
+      reader.ProcessEvents();
+    }
+    reader.ApplyPending();
+  }
+  Check(CONFIG_included_a == 400);
+}
+
+void TestSidecarPaths() {
+  const std::string directory = "/tmp/config_reader_tests_sidecar";
+  mkdir(directory.c_str(), 0755);
+  {
+    std::ofstream grid(directory + "/grid.bin", std::ios::binary);
+    const float values[] = {1, 2, 3, 4};
+    grid.write(reinterpret_cast<const char*>(values), sizeof(values));
+  }
+  WriteFile(directory + "/config.lua",
+            "sidecar_grid = \"grid.bin\"\n"
+            "sidecar = {table = {file = \"grid.bin\", shape = {2, 2}}}\n");
+  // Relative to the config file, not the working directory.
+  config_reader::LuaScript script({directory + "/config.lua"});
+  const std::vector<std::string> locations;
+  const auto grid =
+      script.GetVariable<config_reader::FloatArray>("sidecar_grid", locations);
+  Check(grid.first && grid.second.size() == 4);
+  Check(grid.second.path() == directory + "/grid.bin");
+  const auto table = script.GetVariable<config_reader::FloatArray>(
+      "sidecar.table", locations);
+  Check(table.first && table.second(1, 0) == 3);
+  // Snapshots carry the absolute paths.
+  config_reader::LuaScript fresh({directory + "/config.lua"});
+  fresh.ResolveFilePaths({"sidecar_grid", "sidecar.table"});
+  std::string snapshot;
+  Check(fresh.SerializeGlobals(&snapshot));
+  Check(snapshot.find("sidecar_grid = \"" + directory + "/grid.bin\"") !=
+        std::string::npos);
+  Check(snapshot.find("file = \"" + directory + "/grid.bin\"") !=
+        std::string::npos);
+}
+
+void TestThreadless() {
+  const std::string file = "/tmp/config_reader_tests_threadless.lua";
+  WriteFile(file, "threadless_value = 1\n");
+  CONFIG_INT(threadless_value, "threadless_value");
+  config_reader::ConfigReaderOptions options;
+  options.threadless = true;
+  config_reader::ConfigReader reader({file}, options);
+  Check(CONFIG_threadless_value == 1);
+
+  WriteFile(file, "threadless_value = 2\n");
+  pollfd ready_to_read = {};
+  ready_to_read.fd = reader.fd();
+  ready_to_read.events = POLLIN;
+  // Values only change in ApplyPending().
+  for (int i = 0; i < 100 && CONFIG_threadless_value != 2; ++i) {
+    if (poll(&ready_to_read, 1, 50) > 0) {
+      reader.ProcessEvents();
+    }
+    Check(CONFIG_threadless_value == 1);
+    reader.ApplyPending();
+  }
+  Check(CONFIG_threadless_value == 2);
+}
+
+void TestManualCommit() {
+  const std::string file = "/tmp/config_reader_tests_commit.lua";
+  WriteFile(file, "commit_value = 1\n");
+  CONFIG_INT(commit_value, "commit_value");
+  config_reader::ConfigReaderOptions options;
+  options.threadless = true;
+  options.manual_commit = true;
+  config_reader::ConfigReader reader({file}, options);
+  Check(CONFIG_commit_value == 1);
+  Check(reader.CommittedGeneration() == 1);
+  Check(!reader.HasPendingUpdate());
+  Check(!reader.Commit());
+
+  WriteFile(file, "commit_value = 2\n");
+  pollfd ready_to_read = {};
+  ready_to_read.fd = reader.fd();
+  ready_to_read.events = POLLIN;
+  for (int i = 0; i < 100 && !reader.HasPendingUpdate(); ++i) {
+    if (poll(&ready_to_read, 1, 50) > 0) {
+      reader.ProcessEvents();
+    }
+    reader.ApplyPending();
+  }
+  // Staged, but not applied until the commit.
+  Check(reader.HasPendingUpdate());
+  Check(reader.PendingGeneration() == 2);
+  Check(CONFIG_commit_value == 1);
+  Check(reader.Commit());
+  Check(CONFIG_commit_value == 2);
+  Check(reader.CommittedGeneration() == 2);
+  Check(!reader.HasPendingUpdate());
+  reader.ApplyPending();
+  config_reader::ConfigGeneration generation;
+  Check(reader.History().Get(reader.History().LatestId(), &generation));
+  Check(generation.snapshot.find("commit_value = 2") != std::string::npos);
+}
+
+void TestCurve() {
+  const std::string file = "/tmp/config_reader_tests_curve.lua";
+  WriteFile(file,
+            "square = {fn = function(x) return x * x end, domain = {0, 4},\n"
+            "          samples = 5}\n"
+            "ramp = {domain = {-1, 1}, values = {0, 2, 6}}\n"
+            "broken = {fn = function(x) return nil end, domain = {0, 1},\n"
+            "          samples = 2}\n"
+            "raising = {fn = function(x) error({}) end, domain = {0, 1},\n"
+            "           samples = 2}\n");
+  CONFIG_CURVE(square, "square");
+  CONFIG_CURVE(ramp, "ramp");
+  CONFIG_CURVE(broken, "broken");
+  CONFIG_CURVE(raising, "raising");
+  Check(config_reader::LuaRead({file}));
+  Check(CONFIG_square.size() == 5);
+  Check(CONFIG_square(2) == 4);
+  Check(CONFIG_square(2.5f) == 6.5f);
+  // Clamped to the domain.
+  Check(CONFIG_square(-1) == 0);
+  Check(CONFIG_square(4) == 16);
+  Check(CONFIG_square(10) == 16);
+  Check(CONFIG_ramp(0.5f) == 4);
+  Check(CONFIG_broken(0.5f) == 0);
+  Check(CONFIG_raising(0.5f) == 0);
+  const float x[] = {0.5f, 1, 3.5f};
+  float y[3];
+  CONFIG_square(x, y, 3);
+  Check(y[0] == 0.5f && y[1] == 1 && y[2] == 12.5f);
+
+  // Snapshots hold the samples.
+  Check(config_reader::SnapshotRead(
+      "square = {domain = {0, 1}, values = {1, 3}}\n"));
+  Check(CONFIG_square(0.5f) == 2);
+}
+
+void TestValidation() {
+  using config_reader::config_types::ConfigDouble;
+  using config_reader::config_types::ConfigInt;
+  using config_reader::config_types::ConfigIntList;
+  using config_reader::config_types::ConfigString;
+  config_reader::Registry registry;
+  registry.Bind<ConfigDouble>("validated_gain");
+  registry.Bind<ConfigIntList>("validated_list");
+  registry.Bind<ConfigString>("validated_name");
+  registry.Keys()["validated_count"].reset(
+      new ConfigInt("validated_count", 10, 0));
+  const std::string text =
+      config_reader::WriteSchema(config_reader::ExportSchema(&registry));
+  Check(text ==
+        "validated_count int 0 10\n"
+        "validated_gain double\n"
+        "validated_list intlist\n"
+        "validated_name string\n");
+  std::vector<config_reader::SchemaEntry> schema;
+  std::string error;
+  Check(config_reader::ReadSchema("# comment\n\n" + text, &schema, &error));
+  Check(schema.size() == 4 && schema[0].bounded && schema[0].upper == 10);
+  Check(config_reader::WriteSchema(schema) == text);
+  std::vector<config_reader::SchemaEntry> bad_schema;
+  Check(!config_reader::ReadSchema("x vector9f\n", &bad_schema, &error));
+  Check(!config_reader::ReadSchema("x string 0 1\n", &bad_schema, &error));
+  // Bounds must be values of the type, in order.
+  Check(!config_reader::ReadSchema("ok int 0 1\nx uint -1 10\n", &bad_schema,
+                                   &error));
+  Check(error.compare(0, 7, "line 2:") == 0);
+  Check(!config_reader::ReadSchema("x int 0 1e10\n", &bad_schema, &error));
+  Check(!config_reader::ReadSchema("x int 0 1.5\n", &bad_schema, &error));
+  Check(!config_reader::ReadSchema("x float 0 1e39\n", &bad_schema, &error));
+  Check(!config_reader::ReadSchema("x double 2 1\n", &bad_schema, &error));
+  Check(config_reader::ReadSchema("x uint 0 4294967295\n", &bad_schema,
+                                  &error));
+
+  const std::string common = "/tmp/config_reader_tests_validate_common.lua";
+  const std::string good = "/tmp/config_reader_tests_validate_good.lua";
+  const std::string bad = "/tmp/config_reader_tests_validate_bad.lua";
+  const std::string broken = "/tmp/config_reader_tests_validate_broken.lua";
+  WriteFile(common, "validated_list = {1, 2}\n");
+  WriteFile(good,
+            "validated_gain = 1.5\nvalidated_name = \"a\"\n"
+            "validated_count = 3\n");
+  WriteFile(bad,
+            "validated_gain = \"x\"\nvalidated_list = {1, \"y\"}\n"
+            "validated_count = 11\n");
+  WriteFile(broken, "validated_gain = \n");
+  const std::vector<config_reader::ValidationResult> results =
+      config_reader::ValidateConfigs(schema, {common}, {good, bad, broken},
+                                     config_reader::ScriptLimits(), 2);
+  Check(results.size() == 3);
+  Check(results[0].file == good && results[0].ok());
+  // Not a number, an element not an int, out of bounds, and undefined.
+  Check(results[1].loaded && results[1].errors.size() == 4);
+  Check(!results[2].loaded && !results[2].ok());
+}
+
+// The inotify watches this process holds, across all its descriptors.
+int CountWatches() {
+  int count = 0;
+  DIR* fds = opendir("/proc/self/fdinfo");
+  while (const dirent* entry = readdir(fds)) {
+    std::ifstream info(std::string("/proc/self/fdinfo/") + entry->d_name);
+    std::string line;
+    while (std::getline(info, line)) {
+      count += line.compare(0, 11, "inotify wd:") == 0;
+    }
+  }
+  closedir(fds);
+  return count;
+}
+
+void TestConfigGroup() {
+  using config_reader::config_types::ConfigFloat;
+  using config_reader::config_types::ConfigInt;
+  using config_reader::config_types::ConfigString;
+  const std::string common = "/tmp/config_reader_tests_common.lua";
+  const std::string robot_a = "/tmp/config_reader_tests_robot_a.lua";
+  const std::string robot_b = "/tmp/config_reader_tests_robot_b.lua";
+  WriteFile(common, "speed = 2\n");
+  WriteFile(robot_a, "name = \"a\"\nlimit = speed * 2\nextra = 5\n");
+  WriteFile(robot_b, "name = \"b\"\nlimit = speed * 3\n");
+  config_reader::ConfigGroupOptions options;
+  options.threadless = true;
+  config_reader::ConfigGroup group(options);
+  config_reader::Registry a;
+  config_reader::Registry b;
+  const std::string& name_a = a.Bind<ConfigString>("name");
+  const float& limit_a = a.Bind<ConfigFloat>("limit");
+  const std::string& name_b = b.Bind<ConfigString>("name");
+  const float& limit_b = b.Bind<ConfigFloat>("limit");
+  Check(group.AddContext(&a, {common, robot_a}));
+  Check(group.AddContext(&b, {common, robot_b}));
+  Check(name_a == "a" && limit_a == 4);
+  Check(name_b == "b" && limit_b == 6);
+  Check(config_reader::MapSingleton::Singleton().count("limit") == 0);
+  // The common file is parsed once for both contexts.
+  Check(group.Chunks().Compiled() == 3);
+  Check(group.Chunks().Reused() == 1);
+
+  // Bound after loading, so applied by the next ApplyPending().
+  const int& extra_a = a.Bind<ConfigInt>("extra");
+  Check(extra_a == 0);
+  Check(group.ApplyPending() == 1);
+  Check(extra_a == 5);
+
+  WriteFile(common, "speed = 3\n");
+  pollfd ready_to_read = {};
+  ready_to_read.fd = group.fd();
+  ready_to_read.events = POLLIN;
+  for (int i = 0; i < 100 && limit_a != 6; ++i) {
+    if (poll(&ready_to_read, 1, 50) > 0) {
+      group.ProcessEvents();
+    }
+    group.ApplyPending();
+  }
+  Check(limit_a == 6 && limit_b == 9);
+  Check(group.Chunks().Compiled() == 4);
+
+  // Only robot_b's watch goes; common is still loaded by a.
+  const int watches = CountWatches();
+  group.RemoveContext(&b);
+  Check(group.size() == 1);
+  Check(CountWatches() == watches - 1);
+
+  // A ConfigReader can load into its own registry too.
+  config_reader::Registry c;
+  const float& limit_c = c.Bind<ConfigFloat>("limit");
+  config_reader::ConfigReaderOptions reader_options;
+  reader_options.threadless = true;
+  reader_options.registry = &c;
+  config_reader::ConfigReader reader({common, robot_b}, reader_options);
+  Check(limit_c == 9);
+}
+
+// Sends one request line over an override socket and returns the reply line.
+std::string Request(const int fd, const std::string& request) {
+  const std::string line = request + "\n";
+  Check(write(fd, line.data(), line.size()) ==
+        static_cast<ssize_t>(line.size()));
+  std::string reply;
+  char c;
+  while (read(fd, &c, 1) == 1 && c != '\n') {
+    reply.push_back(c);
+  }
+  return reply;
+}
+
+int Connect(const std::string& path) {
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path.c_str());
+  Check(connect(fd, reinterpret_cast<sockaddr*>(&address),
+                sizeof(address)) == 0);
+  return fd;
+}
+
+void TestOverrides() {
+  CONFIG_INT(seven, "seven");
+  CONFIG_STRUCT(gains, "gains", Gains);
+  config_reader::ConfigReaderOptions options;
+  options.override_socket = "/tmp/config_reader_tests.sock";
+  config_reader::ConfigReader reader({"test_config.lua"}, options);
+
+  const int fd = Connect(options.override_socket);
+  struct stat status;
+  Check(stat(options.override_socket.c_str(), &status) == 0);
+  Check((status.st_mode & 0777) == 0600);
+
+  const uint64_t loaded = reader.History().LatestId();
+  Check(loaded > 0);
+  Check(Request(fd, "set seven 11") == "ok");
+  Check(CONFIG_seven == 11);
+  // The daemon records the override just after replying.
+  for (int i = 0; i < 100 && reader.History().LatestId() == loaded; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  config_reader::ConfigGeneration generation;
+  Check(reader.History().Get(loaded + 1, &generation));
+  Check(generation.snapshot.find("\nseven = 11\n") != std::string::npos);
+  Check(Request(fd, "get seven") == "ok 11");
+  Check(Request(fd, "set seven \"eleven\"").compare(0, 5, "error") == 0);
+  Check(Request(fd, "set seven 1e300").compare(0, 5, "error") == 0);
+  Check(Request(fd, "set seven 7.5").compare(0, 5, "error") == 0);
+  Check(Request(fd, "get seven") == "ok 11");
+  Check(Request(fd, "set missing 1").compare(0, 5, "error") == 0);
+  Check(Request(fd, "set gains " + std::string(1000000, '{'))
+            .compare(0, 5, "error") == 0);
+  Check(CONFIG_seven == 11);
+
+  // A bad value anywhere in a batch means nothing in it is applied.
+  Check(Request(fd, "begin") == "ok");
+  Check(Request(fd, "set seven 12") == "ok");
+  Check(Request(fd, "set gains {kp = 2}").compare(0, 5, "error") == 0);
+  Check(Request(fd, "commit").compare(0, 5, "error") == 0);
+  Check(CONFIG_seven == 11);
+
+  Check(Request(fd, "begin") == "ok");
+  Check(Request(fd, "set seven 7") == "ok");
+  Check(Request(fd, "set gains {kp = 2, ki = 0.25, limits = {-1, 1}, "
+                    "name = \"pid\"}") == "ok");
+  Check(CONFIG_gains.kp == 1.5);
+  Check(Request(fd, "commit") == "ok 2");
+  Check(CONFIG_seven == 7);
+  Check(CONFIG_gains.kp == 2);
+  Check(Request(fd, "set gains.kp 1.5").compare(0, 5, "error") == 0);
+  Check(Request(fd, "set gains {kp = 1.5, ki = 0.25, limits = {-1, 1}, "
+                    "name = \"pid\"}") == "ok");
+  close(fd);
+
+  // Only a stale socket is replaced, never some other file.
+  const std::string not_a_socket = "/tmp/config_reader_tests_not_a_socket";
+  WriteFile(not_a_socket, "keep\n");
+  config_reader::OverrideServer server;
+  std::string error;
+  Check(!server.Open(not_a_socket, &error));
+  std::ifstream kept(not_a_socket);
+  std::string line;
+  Check(std::getline(kept, line) && line == "keep");
+}
+
+void TestStagedOverrides() {
+  const std::string file = "/tmp/config_reader_tests_staged.lua";
+  WriteFile(file, "staged_a = 1\nstaged_b = 2\n");
+  CONFIG_INT(staged_a, "staged_a");
+  CONFIG_INT(staged_b, "staged_b");
+  config_reader::ConfigReaderOptions options;
+  options.manual_commit = true;
+  options.override_socket = "/tmp/config_reader_tests_staged.sock";
+  config_reader::ConfigReader reader({file}, options);
+  const int fd = Connect(options.override_socket);
+
+  // A batch is staged, and takes effect at the next Commit().
+  Check(Request(fd, "begin") == "ok");
+  Check(Request(fd, "set staged_a 3") == "ok");
+  Check(Request(fd, "set staged_b 4") == "ok");
+  Check(Request(fd, "commit") == "ok 2");
+  for (int i = 0; i < 100 && !reader.HasPendingUpdate(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  Check(reader.HasPendingUpdate());
+  Check(CONFIG_staged_a == 1);
+  Check(CONFIG_staged_b == 2);
+  Check(Request(fd, "get staged_a") == "ok 1");
+  const uint64_t loaded = reader.History().LatestId();
+  // Commit() gives up rather than wait while the daemon is staging.
+  bool committed = false;
+  for (int i = 0; i < 100 && !(committed = reader.Commit()); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  Check(committed);
+  Check(CONFIG_staged_a == 3);
+  Check(CONFIG_staged_b == 4);
+  for (int i = 0; i < 100 && reader.History().LatestId() == loaded; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  config_reader::ConfigGeneration generation;
+  Check(reader.History().Get(reader.History().LatestId(), &generation));
+  Check(generation.snapshot.find("\nstaged_a = 3\n") != std::string::npos);
+
+  // Setting a variable twice before a commit keeps the last value.
+  Check(Request(fd, "set staged_a 5") == "ok");
+  Check(Request(fd, "set staged_a 6") == "ok");
+  committed = false;
+  for (int i = 0; i < 100 && !(committed = reader.Commit()); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  Check(committed);
+  Check(CONFIG_staged_a == 6);
+  close(fd);
+}
+
 int main() {
   CONFIG_INT(seven, "seven");
   CONFIG_STRING(str, "str");
@@ -45,6 +781,12 @@ int main() {
   CONFIG_VECTOR2F(sample_vector2f, "sample_vector2f");
   CONFIG_VECTOR2FLIST(sample_vector2f_list, "sample_vector2f_list");
   CONFIG_VECTOR2FLIST(wrapped_sample_vector2f_list, "wrapper.another.sample_vector2f_list");
+  CONFIG_STRUCT(gains, "gains", Gains);
+  CONFIG_STRUCT(bad_gains, "bad_gains", Gains);
+  CONFIG_STRINGDOUBLEMAP(robot_speeds, "robot_speeds");
+  CONFIG_INTSTRINGMAP(sensor_names, "sensor_names");
+  CONFIG_FLOATARRAY(grid, "grid");
+  CONFIG_FLOATARRAY(wrong_shape_grid, "wrong_shape_grid");
   config_reader::ConfigReader reader({"test_config.lua"});
 
   Check(CONFIG_int_list.size() == 16);
@@ -75,6 +817,31 @@ int main() {
   Check(CONFIG_wrapped_sample_vector2f_list[0] == Eigen::Vector2f(9.1, 2.3));
   Check(CONFIG_wrapped_sample_vector2f_list[1] == Eigen::Vector2f(4.5, 6.7));
 
+  Check(CONFIG_gains.kp == 1.5);
+  Check(CONFIG_gains.ki == 0.25f);
+  Check(CONFIG_gains.limits == std::vector<int>({-1, 1}));
+  Check(CONFIG_gains.name == "pid");
+  // One bad member means none of the struct is updated.
+  Check(CONFIG_bad_gains.kp == 0);
+  Check(CONFIG_bad_gains.name.empty());
+
+  Check(CONFIG_robot_speeds.size() == 3);
+  Check(*CONFIG_robot_speeds.Find("alpha") == 1.5);
+  Check(CONFIG_robot_speeds.Get(std::string("gamma-3"), 0.0) == 3.5);
+  Check(CONFIG_robot_speeds.Find("delta") == nullptr);
+  Check(CONFIG_sensor_names.size() == 3);
+  Check(*CONFIG_sensor_names.Find(42) == "imu");
+  Check(!CONFIG_sensor_names.Contains(2));
+  WriteFile("/tmp/config_reader_tests_map_keys.lua",
+            "huge_keys = {[1e20] = 1}\ninf_keys = {[math.huge] = 1}\n");
+  config_reader::LuaScript map_keys({"/tmp/config_reader_tests_map_keys.lua"});
+  Check(!map_keys.GetVariable<config_reader::IntIntMap>("huge_keys", {}).first);
+  Check(!map_keys.GetVariable<config_reader::IntIntMap>("inf_keys", {}).first);
+
+  Check(CONFIG_grid.shape() == std::vector<size_t>({2, 3}));
+  Check(CONFIG_grid.size() == 6);
+  Check(CONFIG_grid(1, 2) == 5.0f);
+  Check(CONFIG_wrong_shape_grid.empty());
 
   Check(CONFIG_seven == 7);
   Check(CONFIG_str == "str");
@@ -83,6 +850,20 @@ int main() {
   Check(CONFIG_seven == 7);
   Check(CONFIG_str == "str");
   Check(std::abs(CONFIG_seven_point_five - 7.5) < 0.0001f);
+  TestScriptLimits();
+  TestSnapshot();
+  TestGenerationHistory();
+  TestProfile();
+  TestPartialReload();
+  TestIncludes();
+  TestSidecarPaths();
+  TestThreadless();
+  TestManualCommit();
+  TestCurve();
+  TestValidation();
+  TestConfigGroup();
+  TestOverrides();
+  TestStagedOverrides();
   std::cout << "All tests passed!\n";
   return 0;
 }
@@ -0,0 +1,173 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+// Validates config files against a schema without linking the program that
+// reads them, e.g. every robot's config before a rollout.
+//
+//   ./validate_configs --schema SCHEMA [--common A.lua,B.lua] [--threads N]
+//                      [--max_instructions M] [--quiet] CONFIG.lua...
+//
+// The schema lists the keys the program reads, one `key type [lower upper]`
+// per line, as written by config_reader::WriteSchema(). Each config is
+// evaluated after the common files, if any, and every key is read with the
+// same conversion and bounds checks as the program. Configs are spread over
+// N threads, one per core by default. Prints each config's errors and
+// timings, and exits with 1 if any config failed.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config_reader/validation.h"
+
+namespace {
+
+struct Options {
+  std::string schema;
+  std::vector<std::string> common;
+  size_t threads;
+  size_t max_instructions;
+  bool quiet;
+  std::vector<std::string> configs;
+
+  Options()
+      : threads(0),
+        max_instructions(config_reader::kDefaultMaxInstructions),
+        quiet(false) {}
+};
+
+std::vector<std::string> SplitCommas(const std::string& list) {
+  std::vector<std::string> items;
+  std::istringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      items.push_back(item);
+    }
+  }
+  return items;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string flag = argv[i];
+    if (flag == "--quiet") {
+      options->quiet = true;
+    } else if (flag.compare(0, 2, "--") != 0) {
+      options->configs.push_back(flag);
+    } else if (i + 1 == argc) {
+      return false;
+    } else if (flag == "--schema") {
+      options->schema = argv[++i];
+    } else if (flag == "--common") {
+      options->common = SplitCommas(argv[++i]);
+    } else if (flag == "--threads") {
+      options->threads = strtoull(argv[++i], nullptr, 10);
+    } else if (flag == "--max_instructions") {
+      options->max_instructions = strtoull(argv[++i], nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return !options->schema.empty() && !options->configs.empty();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    std::cerr << "Usage: " << argv[0]
+              << " --schema SCHEMA [--common A.lua,B.lua] [--threads N]"
+                 " [--max_instructions M] [--quiet] CONFIG.lua..."
+              << std::endl;
+    return 2;
+  }
+  std::ifstream schema_file(options.schema);
+  std::stringstream schema_text;
+  schema_text << schema_file.rdbuf();
+  std::vector<config_reader::SchemaEntry> schema;
+  std::string error;
+  if (!schema_file) {
+    std::cerr << "Can't read " << options.schema << std::endl;
+    return 2;
+  }
+  if (!config_reader::ReadSchema(schema_text.str(), &schema, &error)) {
+    std::cerr << options.schema << ": " << error << std::endl;
+    return 2;
+  }
+
+  size_t threads = options.threads > 0
+                       ? options.threads
+                       : std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, options.configs.size());
+  config_reader::ScriptLimits limits;
+  limits.max_instructions = options.max_instructions;
+  const auto start = std::chrono::steady_clock::now();
+  const std::vector<config_reader::ValidationResult> results =
+      config_reader::ValidateConfigs(schema, options.common, options.configs,
+                                     limits, threads);
+  const double wall_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  size_t failed = 0;
+  double load_ms = 0;
+  double check_ms = 0;
+  std::set<std::string> warnings;
+  for (const config_reader::ValidationResult& result : results) {
+    load_ms += result.load_ms;
+    check_ms += result.check_ms;
+    warnings.insert(result.warnings.begin(), result.warnings.end());
+    if (result.ok()) {
+      if (options.quiet) {
+        continue;
+      }
+    } else {
+      ++failed;
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "%-4s %9.2f ms %9.2f ms  ",
+             result.ok() ? "ok" : "FAIL", result.load_ms, result.check_ms);
+    std::cout << line << result.file << std::endl;
+    for (const std::string& message : result.errors) {
+      std::cout << "    " << message << std::endl;
+    }
+  }
+  for (const std::string& warning : warnings) {
+    std::cerr << warning << std::endl;
+  }
+  char summary[160];
+  snprintf(summary, sizeof(summary),
+           "%zu configs, %zu failed, %zu keys each; %.1f ms on %zu threads "
+           "(%.1f ms loading, %.1f ms checking in total)",
+           results.size(), failed, schema.size(), wall_ms, threads, load_ms,
+           check_ms);
+  std::cout << summary << std::endl;
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_CHUNK_CACHE_H_
+#define CONFIGREADER_CHUNK_CACHE_H_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "config_reader/lua_backend.h"
+
+namespace config_reader {
+
+// Compiled config files, shared between any number of LuaScripts so that a
+// file they all evaluate, e.g. a common file of many robot configs, is parsed
+// once each time it changes rather than once per script. Entries are keyed by
+// chunk name and checked against the source. Safe to use from several
+// threads.
+class ChunkCache {
+  struct Chunk {
+    std::string source;
+    std::shared_ptr<const std::string> bytecode;
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Chunk> chunks_;
+  size_t compiled_;
+  size_t reused_;
+
+  static int Append(lua_State* /* L */, const void* data, size_t size,
+                    void* ud) {
+    static_cast<std::string*>(ud)->append(static_cast<const char*>(data),
+                                          size);
+    return 0;
+  }
+
+ public:
+  ChunkCache() : compiled_(0), reused_(0) {}
+  ChunkCache(const ChunkCache&) = delete;
+  ChunkCache& operator=(const ChunkCache&) = delete;
+
+  // Like luaL_loadbuffer(): pushes the chunk compiled from `source`, or an
+  // error message, and returns the status.
+  int Load(lua_State* L, const std::string& source, const std::string& name) {
+    std::shared_ptr<const std::string> bytecode;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const auto it = chunks_.find(name);
+      if (it != chunks_.end() && it->second.source == source) {
+        bytecode = it->second.bytecode;
+        ++reused_;
+      }
+    }
+    // Loaded outside the lock; an entry replaced meanwhile stays alive.
+    if (bytecode) {
+      return luaL_loadbuffer(L, bytecode->data(), bytecode->size(),
+                             name.c_str());
+    }
+    const int status =
+        luaL_loadbuffer(L, source.data(), source.size(), name.c_str());
+    if (status != 0) {
+      return status;
+    }
+    std::shared_ptr<std::string> dumped(new std::string());
+    if (lua_backend::Dump(L, &ChunkCache::Append, dumped.get()) == 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      Chunk& chunk = chunks_[name];
+      chunk.source = source;
+      chunk.bytecode = dumped;
+      ++compiled_;
+    }
+    return status;
+  }
+
+  // Number of files parsed, and of loads served from the cache instead.
+  size_t Compiled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return compiled_;
+  }
+  size_t Reused() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return reused_;
+  }
+
+  // Number of files held.
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return chunks_.size();
+  }
+};
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_CHUNK_CACHE_H_
@@ -0,0 +1,343 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_CONFIG_GROUP_H_
+#define CONFIGREADER_CONFIG_GROUP_H_
+
+extern "C" {
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "config_reader/chunk_cache.h"
+#include "config_reader/config_reader.h"
+#include "config_reader/lua_script.h"
+#include "config_reader/macros.h"
+
+namespace config_reader {
+
+struct ConfigGroupOptions {
+  // Applies to each context's evaluation separately.
+  ScriptLimits script_limits;
+  // If set, no daemon thread is started. The application instead polls
+  // ConfigGroup::fd() and calls ProcessEvents() and ApplyPending(), as for a
+  // threadless ConfigReader.
+  bool threadless;
+
+  ConfigGroupOptions() : threadless(false) {}
+};
+
+// Keeps many independent configs up to date in one process, e.g. one per
+// robot of a simulator. Each context loads its own files into its own
+// Registry with its own Lua state, but all of them share one thread, one set
+// of file watches and one ChunkCache, so a file common to every context is
+// parsed once per change. When a file changes, only the contexts that load it
+// are reloaded, each evaluating only the files that need it, see
+// LuaScript::Update().
+class ConfigGroup {
+  // As for ConfigReader.
+  static constexpr int kPollIntervalMs = 50;
+  static constexpr int kReloadDelayMs = 2 * kPollIntervalMs;
+
+  struct Context {
+    Registry* registry;
+    std::vector<std::string> files;
+    std::unique_ptr<LuaScript> script;
+    // Whether a watched file changed since the last load.
+    bool changed;
+    bool last_load_succeeded;
+  };
+
+  const ConfigGroupOptions options_;
+  const std::shared_ptr<ChunkCache> chunks_;
+  std::atomic_bool is_running_;
+  std::thread daemon_;
+  int epoll_fd_;
+  int inotify_fd_;
+  // Fires once the files have been quiet for kReloadDelayMs.
+  int timer_fd_;
+  // Guards the members below, which the daemon thread uses, against
+  // AddContext() and RemoveContext().
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Context>> contexts_;
+  // The contexts to reload when a watch descriptor fires. A file loaded by
+  // several contexts has one descriptor.
+  std::unordered_map<int, std::set<Context*>> watchers_;
+  bool files_changed_;
+  bool reload_due_;
+
+  void Watch(Context* context) {
+    static constexpr uint32_t kWatchMask =
+        IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    for (const std::string& file : context->script->WatchedFiles()) {
+      const int wd = inotify_add_watch(inotify_fd_, file.c_str(), kWatchMask);
+      if (wd < 0) {
+        std::cerr << "ERROR: Couldn't add watch to the file: " << file
+                  << std::endl;
+        perror("Reason");
+        continue;
+      }
+      watchers_[wd].insert(context);
+    }
+  }
+
+  void Load(Context* context) {
+    if (context->script == nullptr) {
+      context->script.reset(
+          new LuaScript(context->files, options_.script_limits, chunks_));
+    } else {
+      context->script->Update();
+    }
+    context->last_load_succeeded =
+        LuaRead(context->script.get(), context->registry);
+    *context->registry->Initialized() = true;
+    Watch(context);
+  }
+
+  Context* Find(const Registry* registry) const {
+    for (const auto& context : contexts_) {
+      if (context->registry == registry) {
+        return context.get();
+      }
+    }
+    return nullptr;
+  }
+
+  void AddToEpoll(const int fd) {
+    epoll_event ready_to_read = {};
+    ready_to_read.data.fd = fd;
+    ready_to_read.events = EPOLLIN;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ready_to_read)) {
+      std::cerr << "ERROR: Call to epoll_ctl failed." << std::endl;
+    }
+  }
+
+  void OpenEvents() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+      std::cerr << "ERROR: Call to epoll_create failed." << std::endl;
+    }
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+      std::cerr << "ERROR: Couldn't create a timer" << std::endl;
+    }
+    AddToEpoll(timer_fd_);
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0) {
+      std::cerr << "ERROR: Couldn't initialize inotify" << std::endl;
+      exit(1);
+    }
+    AddToEpoll(inotify_fd_);
+  }
+
+  void Daemon() {
+    pollfd ready_to_read = {};
+    ready_to_read.fd = epoll_fd_;
+    ready_to_read.events = POLLIN;
+    while (is_running_) {
+      if (poll(&ready_to_read, 1, kPollIntervalMs) > 0) {
+        ProcessEvents();
+      }
+      ApplyPending();
+    }
+  }
+
+ public:
+  explicit ConfigGroup(const ConfigGroupOptions& options = ConfigGroupOptions())
+      : options_(options),
+        chunks_(new ChunkCache()),
+        is_running_(true),
+        epoll_fd_(-1),
+        inotify_fd_(-1),
+        timer_fd_(-1),
+        files_changed_(false),
+        reload_due_(false) {
+    OpenEvents();
+    if (!options_.threadless) {
+      daemon_ = std::thread(&ConfigGroup::Daemon, this);
+    }
+  }
+  ConfigGroup(const ConfigGroup&) = delete;
+  ConfigGroup& operator=(const ConfigGroup&) = delete;
+
+  ~ConfigGroup() {
+    is_running_ = false;
+    if (daemon_.joinable()) {
+      daemon_.join();
+    }
+    for (int fd : {epoll_fd_, inotify_fd_, timer_fd_}) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+  }
+
+  // Loads `files` into `registry` and keeps them up to date from then on.
+  // Keys bound in the registry beforehand have their values on return; keys
+  // bound later get theirs at the next ApplyPending(). The registry must stay
+  // alive until it is removed or the group is destroyed. Returns whether the
+  // load succeeded; a context that fails to load is still watched.
+  bool AddContext(Registry* registry, const std::vector<std::string>& files) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (Find(registry) != nullptr) {
+      std::cerr << "ERROR: Registry already belongs to the group" << std::endl;
+      return false;
+    }
+    contexts_.emplace_back(new Context());
+    Context* context = contexts_.back().get();
+    context->registry = registry;
+    context->files = files;
+    context->changed = false;
+    Load(context);
+    return context->last_load_succeeded;
+  }
+
+  // Stops updating `registry`, which keeps its current values.
+  void RemoveContext(const Registry* registry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Context* context = Find(registry);
+    if (context == nullptr) {
+      return;
+    }
+    for (auto watcher = watchers_.begin(); watcher != watchers_.end();) {
+      watcher->second.erase(context);
+      if (watcher->second.empty()) {
+        // No other context loads the file.
+        inotify_rm_watch(inotify_fd_, watcher->first);
+        watcher = watchers_.erase(watcher);
+      } else {
+        ++watcher;
+      }
+    }
+    contexts_.erase(std::find_if(
+        contexts_.begin(), contexts_.end(),
+        [context](const std::unique_ptr<Context>& c) {
+          return c.get() == context;
+        }));
+  }
+
+  // Whether the most recent load of `registry`'s context applied new values.
+  bool LastLoadSucceeded(const Registry* registry) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Context* context = Find(registry);
+    return context != nullptr && context->last_load_succeeded;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return contexts_.size();
+  }
+
+  // The compiled files shared by every context.
+  const ChunkCache& Chunks() const { return *chunks_; }
+
+  // The rest is for ConfigGroupOptions::threadless, and works as for
+  // ConfigReader.
+
+  int fd() const { return epoll_fd_; }
+
+  // Takes note of which contexts' files changed, without blocking.
+  void ProcessEvents() {
+    static constexpr int kMaxEvents = 4;
+    static constexpr int kEventBufferLength =
+        1024 * (sizeof(inotify_event) + 16);
+    std::lock_guard<std::mutex> lock(mutex_);
+    epoll_event events[kMaxEvents];
+    const int nr_events = epoll_wait(epoll_fd_, events, kMaxEvents, 0);
+    for (int i = 0; i < nr_events; ++i) {
+      const int fd = events[i].data.fd;
+      if (fd == inotify_fd_) {
+        alignas(inotify_event) std::array<char, kEventBufferLength> buffer;
+        ssize_t length;
+        while ((length = read(inotify_fd_, buffer.data(), buffer.size())) >
+               0) {
+          for (const char* p = buffer.data(); p < buffer.data() + length;) {
+            const inotify_event* event =
+                reinterpret_cast<const inotify_event*>(p);
+            const auto watcher = watchers_.find(event->wd);
+            if (watcher != watchers_.end()) {
+              for (Context* context : watcher->second) {
+                context->changed = true;
+              }
+              // The file is gone; its contexts watch the new one on reload.
+              if (event->mask & IN_IGNORED) {
+                watchers_.erase(watcher);
+              }
+            }
+            p += sizeof(inotify_event) + event->len;
+          }
+          files_changed_ = true;
+        }
+        if (files_changed_) {
+          // Restarts the delay, so a burst of writes causes one reload.
+          itimerspec timer = {};
+          timer.it_value.tv_nsec = kReloadDelayMs * 1000000L;
+          timerfd_settime(timer_fd_, 0, &timer, nullptr);
+        }
+      } else if (fd == timer_fd_) {
+        uint64_t expirations = 0;
+        if (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+          reload_due_ = files_changed_;
+        }
+      }
+    }
+  }
+
+  // Reloads the contexts whose files changed and have since been quiet, and
+  // those with keys added since their last load. Returns how many it
+  // reloaded.
+  size_t ApplyPending() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t reloaded = 0;
+    for (const auto& context : contexts_) {
+      if ((reload_due_ && context->changed) ||
+          *context->registry->NewKeyAdded()) {
+        context->changed = false;
+        Load(context.get());
+        ++reloaded;
+      }
+    }
+    if (reload_due_) {
+      reload_due_ = false;
+      files_changed_ = false;
+    }
+    return reloaded;
+  }
+};
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_CONFIG_GROUP_H_
@@ -24,145 +24,618 @@
 
 extern "C" {
 #include <libgen.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/inotify.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 }
 
 #include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <fstream>
+#include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "config_reader/generation_history.h"
 #include "config_reader/lua_script.h"
 #include "config_reader/macros.h"
+#include "config_reader/override_channel.h"
+#include "config_reader/profile.h"
+#include "config_reader/shared_snapshot.h"
 #include "config_reader/types/config_generic.h"
 #include "config_reader/types/config_numeric.h"
+#include "config_reader/types/config_struct.h"
 #include "config_reader/types/type_interface.h"
+#include "config_reader/value_text.h"
 
 namespace config_reader {
 
-inline void LuaRead(const std::vector<std::string>& files) {
-  // Create the LuaScript object
-  LuaScript script(files);
+// Applies an evaluated script to every variable of `registry`. Returns false
+// if the files failed to evaluate, in which case every variable keeps its
+// previous value.
+inline bool LuaRead(LuaScript* script,
+                    Registry* registry = &Registry::Default()) {
+  // Retrying won't help until a file changes, so don't leave new keys pending.
+  *registry->NewKeyAdded() = false;
+  if (!script->IsLoaded()) {
+    std::cerr << "Config load failed; keeping previous values." << std::endl;
+    return false;
+  }
   // Loop through the unordered map
-  for (const auto& pair : MapSingleton::Singleton()) {
+  for (const auto& pair : registry->Keys()) {
     config_types::TypeInterface* t = pair.second.get();
     if (t->GetType() == config_types::CNULL) {
       std::cerr << "Key has a type CNULL!" << std::endl;
-      return;
+      return false;
+    }
+    t->SetValue(script);
+  }
+  return true;
+}
+
+// Like LuaRead(), but leaves every variable's value alone and stages the new
+// one instead. Sets *staged to the variables that staged a value, to be
+// applied with TypeInterface::CommitValue(). Returns false, leaving *staged
+// unchanged, if the files failed to evaluate.
+inline bool StageRead(LuaScript* script,
+                      std::vector<config_types::TypeInterface*>* staged,
+                      Registry* registry = &Registry::Default()) {
+  *registry->NewKeyAdded() = false;
+  if (!script->IsLoaded()) {
+    std::cerr << "Config load failed; keeping previous values." << std::endl;
+    return false;
+  }
+  for (const auto& pair : registry->Keys()) {
+    if (pair.second->GetType() == config_types::CNULL) {
+      std::cerr << "Key has a type CNULL!" << std::endl;
+      return false;
+    }
+  }
+  staged->clear();
+  for (const auto& pair : registry->Keys()) {
+    config_types::TypeInterface* t = pair.second.get();
+    if (t->StageValue(script)) {
+      staged->push_back(t);
     }
-    t->SetValue(&script);
   }
-  *MapSingleton::NewKeyAdded() = false;
+  return true;
+}
+
+// Evaluates the files and applies them to every variable, see above. If
+// watched_files is given, it is set to the files whose modification should
+// trigger a reload.
+inline bool LuaRead(const std::vector<std::string>& files,
+                    const ScriptLimits& limits = ScriptLimits(),
+                    std::vector<std::string>* watched_files = nullptr) {
+  // Create the LuaScript object
+  LuaScript script(files, limits);
+  if (!LuaRead(&script)) {
+    return false;
+  }
+  if (watched_files != nullptr) {
+    *watched_files = script.WatchedFiles();
+  }
+  return true;
 }
 
-inline void WaitForInit() {
+// Applies a snapshot written by LuaScript::SerializeGlobals() to every
+// variable of `registry`, without evaluating any Lua. Keys missing from the
+// snapshot keep their values, like keys missing from the files. Returns false
+// if the snapshot can't be parsed, in which case nothing is changed.
+inline bool SnapshotRead(const std::string& snapshot,
+                         Registry* registry = &Registry::Default()) {
+  *registry->NewKeyAdded() = false;
+  text::SnapshotIndex index;
+  std::string error;
+  if (!text::IndexSnapshot(snapshot, &index, &error)) {
+    std::cerr << "Error: failed to parse config snapshot: " << error
+              << std::endl;
+    return false;
+  }
+  for (const auto& pair : registry->Keys()) {
+    config_types::TypeInterface* t = pair.second.get();
+    const auto location = index.find(t->GetKey());
+    if (location == index.end()) {
+      continue;
+    }
+    if (!t->SetValueText(location->second.first, location->second.second,
+                         &error)) {
+      for (const auto& l : t->GetVarLocations()) {
+        std::cerr << l << ": Can't get [" << t->GetKey() << "]. " << error
+                  << std::endl;
+      }
+    }
+  }
+  return true;
+}
+
+inline void WaitForInit(Registry* registry = &Registry::Default()) {
   // Either variables aren't ready yet, or config reader isn't initialized yet.
   // Variables are guaranteed to be initialized after config class is
   // created.
-  while (*MapSingleton::NewKeyAdded() && *MapSingleton::ConfigInitialized()) {
+  while (*registry->NewKeyAdded() && *registry->Initialized()) {
   };
 }
 
+// Read counts of one key, summed over the sites that declare it.
+struct KeyProfile {
+  std::string key;
+  uint64_t estimated_reads;
+  bool read;
+};
+
+// Profiles every key registered in `registry`, hottest first. Keys are only
+// counted when read through a ProfiledRef, so without CONFIG_READER_PROFILE
+// every key appears unread. Sites are matched to keys by name.
+inline std::vector<KeyProfile> ProfileKeys(
+    Registry* registry = &Registry::Default()) {
+  std::unordered_map<std::string, KeyProfile> keys;
+  for (const auto& pair : registry->Keys()) {
+    keys[pair.first] = {pair.first, 0, false};
+  }
+  for (const SiteProfile& site : ProfileSites()) {
+    const auto key = keys.find(site.key);
+    if (key == keys.end()) {
+      continue;
+    }
+    key->second.estimated_reads += site.estimated_reads;
+    key->second.read = key->second.read || site.read;
+  }
+  std::vector<KeyProfile> sorted;
+  for (const auto& pair : keys) {
+    sorted.push_back(pair.second);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const KeyProfile& a, const KeyProfile& b) {
+              return a.estimated_reads != b.estimated_reads
+                         ? a.estimated_reads > b.estimated_reads
+                         : a.key < b.key;
+            });
+  return sorted;
+}
+
+// Writes the `top` hottest keys of `registry` and declaration sites, then
+// every key that was never read.
+inline void DumpProfile(std::ostream& out, const size_t top = 20,
+                        Registry* registry = &Registry::Default()) {
+  if (!kProfilingEnabled) {
+    out << "Built without CONFIG_READER_PROFILE; only explicit ProfiledRef "
+           "reads are counted."
+        << std::endl;
+  }
+  const std::vector<KeyProfile> keys = ProfileKeys(registry);
+  out << "Hottest keys (estimated reads):" << std::endl;
+  for (size_t i = 0; i < keys.size() && i < top && keys[i].read; ++i) {
+    out << "  " << keys[i].estimated_reads << "  " << keys[i].key
+        << std::endl;
+  }
+  std::vector<SiteProfile> sites = ProfileSites();
+  sites.erase(std::remove_if(sites.begin(), sites.end(),
+                             [registry](const SiteProfile& site) {
+                               return registry->Keys().count(site.key) == 0;
+                             }),
+              sites.end());
+  std::sort(sites.begin(), sites.end(),
+            [](const SiteProfile& a, const SiteProfile& b) {
+              return a.estimated_reads > b.estimated_reads;
+            });
+  out << "Hottest sites (estimated reads):" << std::endl;
+  for (size_t i = 0; i < sites.size() && i < top && sites[i].read; ++i) {
+    out << "  " << sites[i].estimated_reads << "  " << sites[i].location
+        << "  " << sites[i].key << std::endl;
+  }
+  out << "Never read:" << std::endl;
+  for (const KeyProfile& key : keys) {
+    if (!key.read) {
+      out << "  " << key.key << std::endl;
+    }
+  }
+}
+
+struct ConfigReaderOptions {
+  ScriptLimits script_limits;
+  // Name of a shared memory segment, e.g. "/robot_config". If set, every
+  // successful load is also published there for subscriber processes.
+  std::string publish_to;
+  // If set, the files are never evaluated. Instead values are taken from the
+  // snapshots published to this segment by another process, which are
+  // checked for every 50 ms.
+  std::string subscribe_to;
+  // Largest snapshot a published segment can hold, in bytes.
+  size_t snapshot_capacity;
+  // Path of a Unix socket to accept live overrides on, see OverrideServer.
+  std::string override_socket;
+  // Number of recent generations kept in ConfigReader::History(), 0 for none.
+  size_t history_capacity;
+  // If set, no daemon thread is started. The application instead polls
+  // ConfigReader::fd() and calls ProcessEvents() and ApplyPending().
+  bool threadless;
+  // If set, a reload or override only stages the new values, and they take
+  // effect when the application calls ConfigReader::Commit(). Ignored by
+  // subscribers.
+  bool manual_commit;
+  // The variables to load into, or null for the default registry that the
+  // CONFIG_* macros bind to. Must outlive the reader.
+  Registry* registry;
+
+  ConfigReaderOptions()
+      : snapshot_capacity(kDefaultSnapshotCapacity),
+        history_capacity(kDefaultHistoryCapacity),
+        threadless(false),
+        manual_commit(false),
+        registry(nullptr) {}
+};
+
 class ConfigReader {
+  // How often the daemon checks for keys added after it started, and how
+  // often subscribers check for a new snapshot.
+  static constexpr int kPollIntervalMs = 50;
+  // A reload waits until the files have been quiet for this long.
+  static constexpr int kReloadDelayMs = 2 * kPollIntervalMs;
+
   std::atomic_bool is_running_;
+  std::atomic_bool last_load_succeeded_;
+  const ConfigReaderOptions options_;
+  const std::vector<std::string> files_;
+  Registry* const registry_;
   std::thread daemon_;
+  // Readable whenever ProcessEvents() has something to do. Watches the
+  // inotify fd, the timer and the override socket.
+  int epoll_fd_;
+  int inotify_fd_;
+  // Fires once the files have been quiet for kReloadDelayMs, or every
+  // kPollIntervalMs for subscribers.
+  int timer_fd_;
+  // Set by ProcessEvents(), cleared by ApplyPending().
+  bool files_changed_;
+  bool reload_due_;
+  OverrideServer override_server_;
+  // Config files plus the sidecar files they reference.
+  std::vector<std::string> watched_files_;
+  // Retained between reloads so that only changed files are evaluated again.
+  std::unique_ptr<LuaScript> script_;
+  std::unique_ptr<SnapshotPublisher> publisher_;
+  SnapshotSubscriber subscriber_;
+  uint64_t snapshot_generation_;
+  std::string snapshot_;
+  GenerationHistory history_;
+  // What the latest generation was made of: the snapshot and files of the
+  // last load, plus the value text of each override applied since.
+  std::string base_snapshot_;
+  std::vector<std::pair<std::string, uint64_t>> file_hashes_;
+  std::map<std::string, std::string> overrides_;
+  // For ConfigReaderOptions::manual_commit. Loads stage values under the
+  // mutex, so Commit() never sees a half-staged load.
+  std::mutex stage_mutex_;
+  std::vector<config_types::TypeInterface*> staged_;
+  std::atomic<uint64_t> staged_generation_;
+  std::atomic<uint64_t> committed_generation_;
+  // The staged load as it will be recorded in the history, if it could be
+  // serialized, and the last committed load until the daemon records it.
+  bool staged_serialized_;
+  ConfigGeneration staged_load_;
+  ConfigGeneration committed_load_;
+  bool load_record_due_;
+  // Overrides are staged too, so a batch takes effect at one Commit(). These
+  // are the ones staged, and the ones committed until the daemon records
+  // them.
+  std::vector<config_types::TypeInterface*> staged_overrides_;
+  std::vector<config_types::TypeInterface*> committed_overrides_;
+  std::atomic_bool record_due_;
 
-  void InitDaemon(const std::vector<std::string> files) {
-    static constexpr int kEventSize = sizeof(inotify_event);
-    static constexpr int kEventBufferLength = (1024 * (kEventSize + 16));
-    static constexpr int kInotifySleep = 50;
-    std::array<char, kEventBufferLength> buffer;
-
-    // Initialize inotify
-    int fd = inotify_init();
-    if (fd < 0) {
-      std::cerr << "ERROR: Couldn't initialize inotify" << std::endl;
-      exit(1);
-    }
+  bool IsSubscriber() const { return !options_.subscribe_to.empty(); }
+  bool IsStaging() const { return options_.manual_commit && !IsSubscriber(); }
 
-    // Add a listener on each parent directory
-    for (const std::string& file : files) {
-      int wd = inotify_add_watch(fd, file.c_str(), IN_MODIFY);
+  // Re-adding a watch on a path is a no-op for the same file, and starts
+  // watching the new file if the old one was replaced by a rename.
+  void WatchFiles() {
+    static constexpr uint32_t kWatchMask =
+        IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    for (const std::string& file : watched_files_) {
+      int wd = inotify_add_watch(inotify_fd_, file.c_str(), kWatchMask);
 
       if (wd < 0) {
         std::cerr << "ERROR: Couldn't add watch to the file: " << file
                   << std::endl;
         perror("Reason");
-        return;
       }
     }
+  }
 
-    int epfd = epoll_create(1);
-    if (epfd < 0) {
-      std::cerr << "ERROR: Call to epoll_create failed." << std::endl;
-    }
-
+  void AddToEpoll(const int fd) {
     epoll_event ready_to_read = {};
     ready_to_read.data.fd = fd;
     ready_to_read.events = EPOLLIN;
-    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ready_to_read)) {
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ready_to_read)) {
       std::cerr << "ERROR: Call to epoll_ctl failed." << std::endl;
     }
+  }
 
-    epoll_event epoll_events;
+  void ArmTimer(const int delay_ms, const int interval_ms) {
+    itimerspec timer = {};
+    timer.it_value.tv_sec = delay_ms / 1000;
+    timer.it_value.tv_nsec = (delay_ms % 1000) * 1000000L;
+    timer.it_interval.tv_sec = interval_ms / 1000;
+    timer.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    timerfd_settime(timer_fd_, 0, &timer, nullptr);
+  }
 
-    auto last_notify = std::chrono::system_clock::now();
-    bool needs_update = false;
+  // Creates the fds behind fd().
+  void OpenEvents() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+      std::cerr << "ERROR: Call to epoll_create failed." << std::endl;
+    }
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0) {
+      std::cerr << "ERROR: Couldn't create a timer" << std::endl;
+    }
+    AddToEpoll(timer_fd_);
+    if (IsSubscriber()) {
+      ArmTimer(kPollIntervalMs, kPollIntervalMs);
+    } else {
+      inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if (inotify_fd_ < 0) {
+        std::cerr << "ERROR: Couldn't initialize inotify" << std::endl;
+        exit(1);
+      }
+      WatchFiles();
+      AddToEpoll(inotify_fd_);
+    }
+    if (!options_.override_socket.empty()) {
+      std::string error;
+      if (override_server_.Open(options_.override_socket, &error)) {
+        AddToEpoll(override_server_.fd());
+      } else {
+        std::cerr << "ERROR: " << error << std::endl;
+      }
+    }
+  }
 
-    // Loop forever, checking for changes to the files above
-    while (is_running_) {
-      // Wait for 50 ms for there to be an available inotify event
-      int nr_events = epoll_wait(epfd, &epoll_events, 1, kInotifySleep);
-
-      // Handle addition of keys after Daemon starts.
-      if (*MapSingleton::NewKeyAdded()) {
-        LuaRead(files);
-        needs_update = false;
-        continue;
+  void CloseEvents() {
+    override_server_.Close();
+    for (int* fd : {&epoll_fd_, &inotify_fd_, &timer_fd_}) {
+      if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
       }
+    }
+  }
 
-      if (nr_events > 0) {
-        // Else if the inotify fd has recieved something that can be read
-        int length = read(fd, &buffer, kEventBufferLength);
-        if (length < 0 || length > kEventBufferLength) {
-          std::cerr << "ERROR: Inotify read failed" << std::endl;
-          continue;
-        }
+  // Keys of sidecar arrays, whose paths snapshots must carry resolved.
+  std::vector<std::string> ArrayKeys() const {
+    std::vector<std::string> keys;
+    for (const auto& pair : registry_->Keys()) {
+      const config_types::Type type = pair.second->GetType();
+      if (type == config_types::CFLOATARRAY ||
+          type == config_types::CDOUBLEARRAY ||
+          type == config_types::CINTARRAY) {
+        keys.push_back(pair.first);
+      }
+    }
+    return keys;
+  }
 
-        for (int i = 0; i < length;) {
-          inotify_event* event = reinterpret_cast<inotify_event*>(&buffer[i]);
-          i += kEventSize + event->len;
+  // Evaluates the files and applies the result, publishing it if enabled.
+  // With manual_commit the result is only staged.
+  void Load() {
+    if (script_ == nullptr) {
+      script_.reset(new LuaScript(files_, options_.script_limits));
+    } else {
+      script_->Update();
+    }
+    // Serialized before staging, so Commit() is never kept waiting for it.
+    const bool serialize =
+        (publisher_ || history_.Enabled()) && script_->IsLoaded();
+    std::string snapshot;
+    if (serialize) {
+      script_->ResolveFilePaths(ArrayKeys());
+    }
+    const bool serialized = serialize && script_->SerializeGlobals(&snapshot);
+    if (serialize && !serialized) {
+      std::cerr << "ERROR: Couldn't serialize config snapshot" << std::endl;
+    }
+    if (options_.manual_commit) {
+      last_load_succeeded_ = Stage(serialized, snapshot);
+    } else {
+      last_load_succeeded_ = LuaRead(script_.get(), registry_);
+    }
+    if (!last_load_succeeded_) {
+      return;
+    }
+    watched_files_ = script_->WatchedFiles();
+    if (!serialized) {
+      return;
+    }
+    std::string error;
+    if (publisher_ && !publisher_->Publish(snapshot, &error)) {
+      std::cerr << "ERROR: Couldn't publish config snapshot: " << error
+                << std::endl;
+    }
+    if (!options_.manual_commit) {
+      RecordLoad(script_->SourceHashes(), snapshot, MonotonicNs(), WallNs());
+    }
+  }
 
-          last_notify = std::chrono::system_clock::now();
-          needs_update = true;
-        }
+  bool Stage(const bool serialized, const std::string& snapshot) {
+    std::lock_guard<std::mutex> lock(stage_mutex_);
+    if (!StageRead(script_.get(), &staged_, registry_)) {
+      return false;
+    }
+    // The load replaces whatever overrides were staged.
+    staged_overrides_.clear();
+    staged_serialized_ = serialized;
+    if (serialized) {
+      staged_load_.file_hashes = script_->SourceHashes();
+      staged_load_.snapshot = snapshot;
+    }
+    ++staged_generation_;
+    return true;
+  }
+
+  // Serves override requests with manual_commit, staging what they set
+  // rather than applying it.
+  void StageOverrides() {
+    std::vector<config_types::TypeInterface*> changed;
+    std::lock_guard<std::mutex> lock(stage_mutex_);
+    override_server_.ProcessEvents(&changed);
+    if (changed.empty()) {
+      return;
+    }
+    for (config_types::TypeInterface* t : changed) {
+      // CommitValue() swaps, so staging a variable twice would undo it.
+      if (std::find(staged_.begin(), staged_.end(), t) == staged_.end()) {
+        staged_.push_back(t);
       }
-      if (needs_update && std::chrono::duration_cast<std::chrono::milliseconds>(
-                              std::chrono::system_clock::now() - last_notify)
-                                  .count() > 2 * kInotifySleep) {
-        LuaRead(files);
-        needs_update = false;
+      staged_overrides_.push_back(t);
+    }
+    ++staged_generation_;
+  }
+
+  // Records the last committed load and overrides, taken as changing the
+  // values when Commit() was called.
+  void RecordCommit() {
+    if (!record_due_) {
+      return;
+    }
+    bool load_due = false;
+    ConfigGeneration committed;
+    std::vector<config_types::TypeInterface*> overrides;
+    {
+      std::lock_guard<std::mutex> lock(stage_mutex_);
+      load_due = load_record_due_;
+      if (load_due) {
+        std::swap(committed, committed_load_);
       }
+      std::swap(overrides, committed_overrides_);
+      load_record_due_ = false;
+      record_due_ = false;
+    }
+    if (load_due) {
+      RecordLoad(committed.file_hashes, committed.snapshot,
+                 committed.monotonic_ns, committed.wall_ns);
     }
+    RecordOverrides(overrides);
+  }
 
-    // Clean up
-    close(epfd);
-    close(fd);
+  // Records a generation if a load changed anything, stamped with when it
+  // took effect. Loading also undoes any overrides.
+  void RecordLoad(
+      const std::vector<std::pair<std::string, uint64_t>>& file_hashes,
+      const std::string& snapshot, const int64_t monotonic_ns,
+      const int64_t wall_ns) {
+    if (snapshot == base_snapshot_ && file_hashes == file_hashes_ &&
+        overrides_.empty() && history_.LatestId() > 0) {
+      return;
+    }
+    base_snapshot_ = snapshot;
+    file_hashes_ = file_hashes;
+    overrides_.clear();
+    history_.RecordAt(monotonic_ns, wall_ns, file_hashes_, base_snapshot_);
   }
 
-  void CreateDaemon(const std::vector<std::string> files) {
-    LuaRead(files);
-    *MapSingleton::ConfigInitialized() = true;
+  void RecordOverrides(
+      const std::vector<config_types::TypeInterface*>& changed) {
+    if (changed.empty() || !history_.Enabled()) {
+      return;
+    }
+    for (const config_types::TypeInterface* t : changed) {
+      overrides_[t->GetKey()] = t->GetValueText();
+    }
+    // Later assignments to a key take precedence in SnapshotRead().
+    std::string snapshot = base_snapshot_;
+    for (const auto& override_value : overrides_) {
+      text::WriteKey(override_value.first, &snapshot);
+      snapshot.append(override_value.second);
+      snapshot.push_back('\n');
+    }
+    history_.Record(file_hashes_, snapshot);
+  }
+
+  void Reload() {
+    Load();
+    WatchFiles();
+  }
+
+  // Applies the latest published snapshot if it is new, or if keys were added
+  // since it was applied.
+  void PollSnapshot() {
+    if (!subscriber_.IsOpen()) {
+      std::string error;
+      if (!subscriber_.Open(options_.subscribe_to, &error)) {
+        *registry_->NewKeyAdded() = false;
+        return;
+      }
+      snapshot_generation_ = 0;
+    }
+    const bool updated = subscriber_.Read(&snapshot_generation_, &snapshot_);
+    if (snapshot_generation_ == 0) {
+      *registry_->NewKeyAdded() = false;
+      return;
+    }
+    if (updated || *registry_->NewKeyAdded()) {
+      last_load_succeeded_ = SnapshotRead(snapshot_, registry_);
+      if (last_load_succeeded_ && history_.Enabled()) {
+        RecordLoad({}, snapshot_, MonotonicNs(), WallNs());
+      }
+    }
+  }
+
+  // Loop of the daemon thread, built on the same calls as threadless mode.
+  void Daemon() {
+    pollfd ready_to_read = {};
+    ready_to_read.fd = epoll_fd_;
+    ready_to_read.events = POLLIN;
+    while (is_running_) {
+      // Wake up at least every kPollIntervalMs to check for new keys.
+      if (poll(&ready_to_read, 1, kPollIntervalMs) > 0) {
+        ProcessEvents();
+      }
+      ApplyPending();
+    }
+  }
+
+  void CreateDaemon() {
+    if (IsSubscriber()) {
+      PollSnapshot();
+      if (!subscriber_.IsOpen()) {
+        std::cerr << "Waiting for a config publisher on "
+                  << options_.subscribe_to << std::endl;
+      }
+    } else {
+      if (!options_.publish_to.empty()) {
+        std::string error;
+        publisher_.reset(new SnapshotPublisher());
+        if (!publisher_->Open(options_.publish_to,
+                              options_.snapshot_capacity, &error)) {
+          std::cerr << "ERROR: " << error << std::endl;
+          publisher_.reset();
+        }
+      }
+      watched_files_ = files_;
+      Load();
+      if (options_.manual_commit) {
+        // The initial values take effect right away.
+        Commit();
+        RecordCommit();
+      }
+    }
+    OpenEvents();
+    *registry_->Initialized() = true;
     is_running_ = true;
-    daemon_ = std::thread(&ConfigReader::InitDaemon, this, files);
+    if (!options_.threadless) {
+      daemon_ = std::thread(&ConfigReader::Daemon, this);
+    }
   }
 
   void Stop() {
@@ -170,12 +643,156 @@ class ConfigReader {
     if (daemon_.joinable()) {
       daemon_.join();
     }
+    CloseEvents();
   }
 
  public:
   ConfigReader() = delete;
-  ConfigReader(const std::vector<std::string>& files) { CreateDaemon(files); }
+  ConfigReader(const std::vector<std::string>& files,
+               const ConfigReaderOptions& options = ConfigReaderOptions())
+      : last_load_succeeded_(false),
+        options_(options),
+        files_(files),
+        registry_(options.registry != nullptr ? options.registry
+                                              : &Registry::Default()),
+        epoll_fd_(-1),
+        inotify_fd_(-1),
+        timer_fd_(-1),
+        files_changed_(false),
+        reload_due_(false),
+        override_server_(registry_, IsStaging()),
+        snapshot_generation_(0),
+        history_(options.history_capacity),
+        staged_generation_(0),
+        committed_generation_(0),
+        staged_serialized_(false),
+        load_record_due_(false),
+        record_due_(false) {
+    CreateDaemon();
+  }
   ~ConfigReader() { Stop(); }
+
+  // Whether the most recent load or reload applied new values. A failed
+  // reload leaves every variable at its previous value.
+  bool LastLoadSucceeded() const { return last_load_succeeded_; }
+
+  // Recent generations of values, each recorded when a load or override
+  // changed them. Safe to query from any thread.
+  const GenerationHistory& History() const { return history_; }
+
+  // These are for ConfigReaderOptions::manual_commit, where reloads are
+  // evaluated and checked in the background, then staged until the
+  // application applies them at a point of its choosing. Each staged load is
+  // numbered, starting at 1 for the initial load, which is committed right
+  // away. Keys added later also stay at their defaults until a commit. Safe
+  // to call from any thread.
+
+  // Whether a load has been staged since the last commit.
+  bool HasPendingUpdate() const {
+    return staged_generation_ != committed_generation_;
+  }
+
+  // Number of the newest staged load, and of the load in effect.
+  uint64_t PendingGeneration() const { return staged_generation_; }
+  uint64_t CommittedGeneration() const { return committed_generation_; }
+
+  // Applies the newest staged load, if any, and returns whether it did. Only
+  // swaps values, so never allocates or evaluates Lua. If a load is being
+  // staged at that moment, it returns false rather than wait, and the update
+  // is applied by a later call.
+  bool Commit() {
+    std::unique_lock<std::mutex> lock(stage_mutex_, std::try_to_lock);
+    if (!lock.owns_lock() || !HasPendingUpdate()) {
+      return false;
+    }
+    for (config_types::TypeInterface* t : staged_) {
+      t->CommitValue();
+    }
+    staged_.clear();
+    committed_generation_ = staged_generation_.load();
+    if (staged_serialized_) {
+      staged_load_.monotonic_ns = MonotonicNs();
+      staged_load_.wall_ns = WallNs();
+      std::swap(committed_load_, staged_load_);
+      staged_serialized_ = false;
+      load_record_due_ = true;
+      // Overrides committed before it but not yet recorded are undone by
+      // it, and go unrecorded.
+      committed_overrides_.clear();
+      record_due_ = true;
+    }
+    if (!staged_overrides_.empty()) {
+      committed_overrides_.insert(committed_overrides_.end(),
+                                  staged_overrides_.begin(),
+                                  staged_overrides_.end());
+      staged_overrides_.clear();
+      record_due_ = true;
+    }
+    return true;
+  }
+
+  // The rest is for ConfigReaderOptions::threadless, where the application
+  // drives the reader instead of a daemon thread. It must call both from one
+  // thread, and must not call them otherwise.
+
+  // Becomes readable when ProcessEvents() has work to do, e.g. for adding to
+  // the application's own epoll set.
+  int fd() const { return epoll_fd_; }
+
+  // Takes note of changed files and serves override requests, without
+  // blocking. Cheap: nothing is evaluated.
+  void ProcessEvents() {
+    static constexpr int kMaxEvents = 4;
+    static constexpr int kEventSize = sizeof(inotify_event);
+    static constexpr int kEventBufferLength = (1024 * (kEventSize + 16));
+    epoll_event events[kMaxEvents];
+    const int nr_events = epoll_wait(epoll_fd_, events, kMaxEvents, 0);
+    for (int i = 0; i < nr_events; ++i) {
+      const int fd = events[i].data.fd;
+      if (fd == inotify_fd_) {
+        std::array<char, kEventBufferLength> buffer;
+        // Only whether anything changed matters, so drain the events.
+        while (read(inotify_fd_, &buffer, kEventBufferLength) > 0) {
+          files_changed_ = true;
+        }
+        if (files_changed_) {
+          // Restarts the delay, so a burst of writes causes one reload.
+          ArmTimer(kReloadDelayMs, 0);
+        }
+      } else if (fd == timer_fd_) {
+        uint64_t expirations = 0;
+        if (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+          reload_due_ = IsSubscriber() || files_changed_;
+        }
+      } else if (fd == override_server_.fd()) {
+        if (IsStaging()) {
+          StageOverrides();
+        } else {
+          std::vector<config_types::TypeInterface*> changed;
+          override_server_.ProcessEvents(&changed);
+          RecordOverrides(changed);
+        }
+      }
+    }
+  }
+
+  // Reloads if the files changed and have since been quiet, a new snapshot
+  // may have been published, or keys were added. Evaluates Lua, so this is
+  // the expensive part. Returns whether a reload was attempted.
+  bool ApplyPending() {
+    RecordCommit();
+    if (!reload_due_ && !*registry_->NewKeyAdded()) {
+      return false;
+    }
+    reload_due_ = false;
+    if (IsSubscriber()) {
+      PollSnapshot();
+      return true;
+    }
+    files_changed_ = false;
+    Reload();
+    return true;
+  }
 };
 
 }  // namespace config_reader
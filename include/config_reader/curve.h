@@ -0,0 +1,124 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_CURVE_H_
+#define CONFIGREADER_CURVE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <eigen3/Eigen/Core>
+#include <string>
+#include <vector>
+
+namespace config_reader {
+
+// Most samples a curve may have.
+static constexpr size_t kMaxCurveSamples = 1 << 20;
+
+// A function of one variable, sampled at evenly spaced points over a domain
+// when the config is loaded. Lookups interpolate linearly between samples in
+// constant time, clamping to the domain, so hot loops never call into Lua.
+// The default curve is 0 everywhere on [0, 1].
+class Curve {
+  // The samples, plus a copy of the last one so that interpolation needs no
+  // bounds check at the upper end of the domain.
+  std::vector<float, Eigen::aligned_allocator<float>> samples_;
+  float lower_;
+  float upper_;
+  float inverse_step_;
+  float last_index_;
+
+ public:
+  Curve()
+      : samples_(2, 0.0f),
+        lower_(0),
+        upper_(1),
+        inverse_step_(1),
+        last_index_(1) {}
+
+  // Takes values sampled at evenly spaced points from lower to upper, both
+  // included. Leaves the curve unchanged on error.
+  bool Set(const float lower, const float upper, std::vector<float> values,
+           std::string* error) {
+    if (!(lower < upper) || !std::isfinite(lower) || !std::isfinite(upper)) {
+      *error = "Domain must be finite with lower < upper";
+      return false;
+    }
+    if (values.size() < 2 || values.size() > kMaxCurveSamples) {
+      *error = "Needs between 2 and " + std::to_string(kMaxCurveSamples) +
+               " samples, has " + std::to_string(values.size());
+      return false;
+    }
+    for (const float& value : values) {
+      if (!std::isfinite(value)) {
+        *error = "Samples must be finite";
+        return false;
+      }
+    }
+    samples_.assign(values.begin(), values.end());
+    samples_.push_back(values.back());
+    lower_ = lower;
+    upper_ = upper;
+    last_index_ = static_cast<float>(values.size() - 1);
+    inverse_step_ = last_index_ / (upper - lower);
+    return true;
+  }
+
+  // The interpolated value at x. Branch free.
+  float operator()(const float x) const {
+    // max and min in this order also map NaN to the lower end.
+    const float t =
+        std::min(last_index_, std::max(0.0f, (x - lower_) * inverse_step_));
+    const int i = static_cast<int>(t);
+    return samples_[i] + (t - i) * (samples_[i + 1] - samples_[i]);
+  }
+
+  // Looks up count values at once. y must not overlap the samples; with that
+  // the loop vectorizes where the target has gather instructions, e.g. with
+  // -mavx2.
+  void operator()(const float* x, float* __restrict y,
+                  const size_t count) const {
+    const float* samples = samples_.data();
+    const float lower = lower_;
+    const float inverse_step = inverse_step_;
+    const float last_index = last_index_;
+    for (size_t i = 0; i < count; ++i) {
+      const float t =
+          std::min(last_index, std::max(0.0f, (x[i] - lower) * inverse_step));
+      const int j = static_cast<int>(t);
+      y[i] = samples[j] + (t - j) * (samples[j + 1] - samples[j]);
+    }
+  }
+
+  float lower() const { return lower_; }
+  float upper() const { return upper_; }
+  // Number of samples.
+  size_t size() const { return samples_.size() - 1; }
+  const float* data() const { return samples_.data(); }
+  const float* begin() const { return samples_.data(); }
+  const float* end() const { return samples_.data() + size(); }
+  float operator[](const size_t i) const { return samples_[i]; }
+};
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_CURVE_H_
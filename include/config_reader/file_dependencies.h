@@ -0,0 +1,114 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_FILE_DEPENDENCIES_H_
+#define CONFIGREADER_FILE_DEPENDENCIES_H_
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace config_reader {
+
+// Globals touched, and files included, by one config file during its last
+// evaluation.
+struct FileAccesses {
+  // Globals the file assigns, or tables it modifies in place.
+  std::set<std::string> defines;
+  std::set<std::string> reads;
+  // Files it loaded with dofile, loadfile or require.
+  std::set<std::string> includes;
+  // Whether it used _G, through which its accesses can't be tracked.
+  bool uses_global_table = false;
+};
+
+namespace util {
+
+inline bool Intersects(const std::set<std::string>& a,
+                       const std::set<std::string>& b) {
+  for (const std::string& name : a) {
+    if (b.count(name) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Globals defined by the files marked in `rerun`.
+inline std::set<std::string> DefinedBy(const std::vector<FileAccesses>& files,
+                                       const std::vector<bool>& rerun) {
+  std::set<std::string> names;
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (rerun[i]) {
+      names.insert(files[i].defines.begin(), files[i].defines.end());
+    }
+  }
+  return names;
+}
+
+// Marks every file that defines or reads one of `names`, then repeats for the
+// globals those files define. The globals a re-run defines are cleared before
+// it starts, so any file that helped set them, or saw them, has to run again.
+inline void AddDependents(const std::vector<FileAccesses>& files,
+                          std::set<std::string> names,
+                          std::vector<bool>* rerun) {
+  bool added = true;
+  while (added) {
+    added = false;
+    for (size_t i = 0; i < files.size(); ++i) {
+      if ((*rerun)[i] || !(Intersects(files[i].defines, names) ||
+                           Intersects(files[i].reads, names))) {
+        continue;
+      }
+      (*rerun)[i] = true;
+      names.insert(files[i].defines.begin(), files[i].defines.end());
+      added = true;
+    }
+  }
+}
+
+// True if file `reader` reads a global that a later file, which isn't being
+// re-run, defines. On top of the retained state the reader would see that
+// later value, where evaluating every file in order would not.
+inline bool UsesGlobalTable(const std::vector<FileAccesses>& files) {
+  for (const FileAccesses& accesses : files) {
+    if (accesses.uses_global_table) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool SeesLaterDefinition(const std::vector<FileAccesses>& files,
+                                const std::vector<bool>& rerun,
+                                const size_t reader) {
+  for (size_t i = reader + 1; i < files.size(); ++i) {
+    if (!rerun[i] && Intersects(files[reader].reads, files[i].defines)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace util
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_FILE_DEPENDENCIES_H_
@@ -0,0 +1,183 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_FLAT_MAP_H_
+#define CONFIGREADER_FLAT_MAP_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace config_reader {
+
+namespace util {
+// Finalizer from splitmix64; spreads nearby keys across the whole table.
+inline uint64_t MixHash(uint64_t h) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+// FNV-1a over the bytes of the key.
+inline uint64_t HashKey(const char* data, const size_t length) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < length; ++i) {
+    h ^= static_cast<unsigned char>(data[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return MixHash(h);
+}
+
+inline uint64_t HashKey(const std::string& key) {
+  return HashKey(key.data(), key.size());
+}
+
+inline uint64_t HashKey(const char* key) { return HashKey(key, strlen(key)); }
+
+inline uint64_t HashKey(const int& key) {
+  return MixHash(static_cast<uint64_t>(static_cast<int64_t>(key)));
+}
+}  // namespace util
+
+// Read-only hash map built once from a list of entries, used for config
+// dictionaries. Entries are stored contiguously and looked up through a
+// compact open addressing (linear probing) index kept at most half full, so a
+// lookup is usually a single probe. String keyed maps can be queried with a
+// `const char*` without constructing a std::string.
+template <typename Key, typename Value>
+class FlatMap {
+  // index is one past the position in entries_; 0 marks an empty slot. tag
+  // holds the upper hash bits to skip most key comparisons on collisions.
+  struct Slot {
+    uint32_t tag;
+    uint32_t index;
+  };
+
+ public:
+  using value_type = std::pair<Key, Value>;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  FlatMap() : mask_(0) {}
+
+  // Entries whose key duplicates an earlier entry are dropped.
+  explicit FlatMap(std::vector<value_type> entries) : mask_(0) {
+    if (entries.empty()) {
+      return;
+    }
+    size_t capacity = 8;
+    while (capacity < 2 * entries.size()) {
+      capacity *= 2;
+    }
+    slots_.assign(capacity, Slot{0, 0});
+    mask_ = capacity - 1;
+    entries_.reserve(entries.size());
+    for (value_type& entry : entries) {
+      const uint64_t hash = util::HashKey(entry.first);
+      const uint32_t tag = static_cast<uint32_t>(hash >> 32);
+      size_t i = static_cast<size_t>(hash) & mask_;
+      bool duplicate = false;
+      for (; slots_[i].index != 0; i = (i + 1) & mask_) {
+        if (slots_[i].tag == tag &&
+            entries_[slots_[i].index - 1].first == entry.first) {
+          duplicate = true;
+          break;
+        }
+      }
+      if (duplicate) {
+        continue;
+      }
+      entries_.push_back(std::move(entry));
+      slots_[i] = Slot{tag, static_cast<uint32_t>(entries_.size())};
+    }
+  }
+
+  // Returns nullptr if the key is not present.
+  template <typename Query>
+  const Value* Find(const Query& key) const {
+    if (entries_.empty()) {
+      return nullptr;
+    }
+    const uint64_t hash = util::HashKey(key);
+    const uint32_t tag = static_cast<uint32_t>(hash >> 32);
+    for (size_t i = static_cast<size_t>(hash) & mask_;; i = (i + 1) & mask_) {
+      const Slot& slot = slots_[i];
+      if (slot.index == 0) {
+        return nullptr;
+      }
+      if (slot.tag == tag && entries_[slot.index - 1].first == key) {
+        return &entries_[slot.index - 1].second;
+      }
+    }
+  }
+
+  template <typename Query>
+  bool Contains(const Query& key) const {
+    return Find(key) != nullptr;
+  }
+
+  template <typename Query>
+  const Value& Get(const Query& key, const Value& default_value) const {
+    const Value* value = Find(key);
+    return (value == nullptr) ? default_value : *value;
+  }
+
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+  const_iterator begin() const { return entries_.begin(); }
+  const_iterator end() const { return entries_.end(); }
+
+  bool operator==(const FlatMap& other) const {
+    if (size() != other.size()) {
+      return false;
+    }
+    for (const value_type& entry : entries_) {
+      const Value* value = other.Find(entry.first);
+      if (value == nullptr || !(*value == entry.second)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  bool operator!=(const FlatMap& other) const { return !(*this == other); }
+
+ private:
+  std::vector<value_type> entries_;
+  std::vector<Slot> slots_;
+  size_t mask_;
+};
+
+using StringIntMap = FlatMap<std::string, int>;
+using StringDoubleMap = FlatMap<std::string, double>;
+using StringFloatMap = FlatMap<std::string, float>;
+using StringStringMap = FlatMap<std::string, std::string>;
+using StringBoolMap = FlatMap<std::string, bool>;
+using IntIntMap = FlatMap<int, int>;
+using IntDoubleMap = FlatMap<int, double>;
+using IntStringMap = FlatMap<int, std::string>;
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_FLAT_MAP_H_
@@ -0,0 +1,283 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_GENERATION_HISTORY_H_
+#define CONFIGREADER_GENERATION_HISTORY_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace config_reader {
+
+static constexpr size_t kDefaultHistoryCapacity = 16;
+
+// Current steady_clock and system_clock times, as stored in ConfigGeneration.
+inline int64_t MonotonicNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+inline int64_t WallNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// One resolved configuration, as applied to the variables.
+struct ConfigGeneration {
+  uint64_t id;
+  // steady_clock (CLOCK_MONOTONIC) and system_clock times at which the
+  // generation was applied, in nanoseconds.
+  int64_t monotonic_ns;
+  int64_t wall_ns;
+  // Each config file with a hash of the contents it was evaluated from.
+  std::vector<std::pair<std::string, uint64_t>> file_hashes;
+  // Every value, in the format of LuaScript::SerializeGlobals().
+  std::string snapshot;
+
+  ConfigGeneration() : id(0), monotonic_ns(0), wall_ns(0) {}
+};
+
+// Keeps the most recent generations. There must be a single writer calling
+// Record() or RecordAt(), while any thread may query without blocking it or
+// each other.
+//
+// Generations are never changed once recorded. A generation pushed out of
+// the ring is only freed once no query is in progress, so queries need no
+// lock, just a count of active readers.
+class GenerationHistory {
+  const size_t capacity_;
+  std::unique_ptr<std::atomic<const ConfigGeneration*>[]> slots_;
+  std::atomic<uint64_t> latest_id_;
+  mutable std::atomic<int> active_readers_;
+  // Generations pushed out of the ring that may still be in use. Only
+  // touched by the writer.
+  std::vector<const ConfigGeneration*> retired_;
+
+  class ReadSection {
+    std::atomic<int>* active_readers_;
+
+   public:
+    explicit ReadSection(std::atomic<int>* active_readers)
+        : active_readers_(active_readers) {
+      ++*active_readers_;
+    }
+    ~ReadSection() { --*active_readers_; }
+  };
+
+  const ConfigGeneration* Slot(const uint64_t id) const {
+    if (capacity_ == 0) {
+      return nullptr;
+    }
+    const ConfigGeneration* generation = slots_[id % capacity_].load();
+    return (generation != nullptr && generation->id == id) ? generation
+                                                           : nullptr;
+  }
+
+  void FreeRetired() {
+    if (active_readers_.load() != 0) {
+      return;
+    }
+    for (const ConfigGeneration* generation : retired_) {
+      delete generation;
+    }
+    retired_.clear();
+  }
+
+ public:
+  explicit GenerationHistory(const size_t capacity = kDefaultHistoryCapacity)
+      : capacity_(capacity),
+        slots_(new std::atomic<const ConfigGeneration*>[capacity]),
+        latest_id_(0),
+        active_readers_(0) {
+    for (size_t i = 0; i < capacity_; ++i) {
+      slots_[i].store(nullptr);
+    }
+  }
+  GenerationHistory(const GenerationHistory&) = delete;
+  GenerationHistory& operator=(const GenerationHistory&) = delete;
+  ~GenerationHistory() {
+    for (size_t i = 0; i < capacity_; ++i) {
+      delete slots_[i].load();
+    }
+    for (const ConfigGeneration* generation : retired_) {
+      delete generation;
+    }
+  }
+
+  bool Enabled() const { return capacity_ > 0; }
+
+  // Records a generation applied now, returning its id. Ids start at 1.
+  uint64_t Record(std::vector<std::pair<std::string, uint64_t>> file_hashes,
+                  std::string snapshot) {
+    return RecordAt(MonotonicNs(), WallNs(), std::move(file_hashes),
+                    std::move(snapshot));
+  }
+
+  // Records a generation applied at the given steady_clock and system_clock
+  // times, for when it is recorded some time after taking effect.
+  uint64_t RecordAt(const int64_t monotonic_ns, const int64_t wall_ns,
+                    std::vector<std::pair<std::string, uint64_t>> file_hashes,
+                    std::string snapshot) {
+    if (capacity_ == 0) {
+      return 0;
+    }
+    ConfigGeneration* generation = new ConfigGeneration();
+    generation->id = latest_id_.load() + 1;
+    generation->monotonic_ns = monotonic_ns;
+    generation->wall_ns = wall_ns;
+    generation->file_hashes = std::move(file_hashes);
+    generation->snapshot = std::move(snapshot);
+    const ConfigGeneration* replaced =
+        slots_[generation->id % capacity_].exchange(generation);
+    latest_id_.store(generation->id);
+    if (replaced != nullptr) {
+      retired_.push_back(replaced);
+    }
+    FreeRetired();
+    return generation->id;
+  }
+
+  // Id of the newest generation, or 0 if none was recorded.
+  uint64_t LatestId() const { return latest_id_.load(); }
+
+  // Copies generation `id` into *generation, if it is still held.
+  bool Get(const uint64_t id, ConfigGeneration* generation) const {
+    ReadSection section(&active_readers_);
+    const ConfigGeneration* found = Slot(id);
+    if (found == nullptr) {
+      return false;
+    }
+    *generation = *found;
+    return true;
+  }
+
+  // Copies the generation in effect at steady_clock time `monotonic_ns`,
+  // i.e. the newest one applied at or before it. Fails if that generation
+  // was already pushed out, or nothing was applied yet at that time.
+  bool GetAt(const int64_t monotonic_ns, ConfigGeneration* generation) const {
+    ReadSection section(&active_readers_);
+    const uint64_t latest = latest_id_.load();
+    for (uint64_t id = latest; id > 0 && id + capacity_ > latest; --id) {
+      const ConfigGeneration* found = Slot(id);
+      if (found == nullptr) {
+        return false;
+      }
+      if (found->monotonic_ns <= monotonic_ns) {
+        *generation = *found;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Copies every generation held, oldest first.
+  std::vector<ConfigGeneration> GetAll() const {
+    ReadSection section(&active_readers_);
+    std::vector<ConfigGeneration> generations;
+    const uint64_t latest = latest_id_.load();
+    const uint64_t oldest = latest >= capacity_ ? latest - capacity_ + 1 : 1;
+    for (uint64_t id = oldest; id <= latest; ++id) {
+      const ConfigGeneration* found = Slot(id);
+      if (found != nullptr) {
+        generations.push_back(*found);
+      }
+    }
+    return generations;
+  }
+};
+
+// Writes a generation as its snapshot preceded by `--` comment lines holding
+// the rest of it. The result can be passed to SnapshotRead() as is, or to
+// ImportGeneration().
+inline std::string ExportGeneration(const ConfigGeneration& generation) {
+  std::ostringstream text;
+  text << "-- generation " << generation.id << "\n";
+  text << "-- monotonic_ns " << generation.monotonic_ns << "\n";
+  text << "-- wall_ns " << generation.wall_ns << "\n";
+  for (const auto& file : generation.file_hashes) {
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(file.second));
+    text << "-- file " << hash << " " << file.first << "\n";
+  }
+  text << generation.snapshot;
+  return text.str();
+}
+
+// Reads the output of ExportGeneration().
+inline bool ImportGeneration(const std::string& text,
+                             ConfigGeneration* generation,
+                             std::string* error) {
+  ConfigGeneration imported;
+  size_t position = 0;
+  while (text.compare(position, 3, "-- ") == 0) {
+    const size_t end = text.find('\n', position);
+    if (end == std::string::npos) {
+      *error = "Unterminated header line";
+      return false;
+    }
+    std::istringstream line(text.substr(position + 3, end - position - 3));
+    position = end + 1;
+    std::string field;
+    line >> field;
+    if (field == "generation") {
+      line >> imported.id;
+    } else if (field == "monotonic_ns") {
+      line >> imported.monotonic_ns;
+    } else if (field == "wall_ns") {
+      line >> imported.wall_ns;
+    } else if (field == "file") {
+      std::string hash;
+      std::string path;
+      line >> hash >> std::ws;
+      std::getline(line, path);
+      imported.file_hashes.emplace_back(path,
+                                        strtoull(hash.c_str(), nullptr, 16));
+    } else {
+      continue;
+    }
+    if (line.fail()) {
+      *error = "Malformed header line: -- " + line.str();
+      return false;
+    }
+  }
+  if (imported.id == 0) {
+    *error = "Missing generation header";
+    return false;
+  }
+  imported.snapshot = text.substr(position);
+  *generation = std::move(imported);
+  return true;
+}
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_GENERATION_HISTORY_H_
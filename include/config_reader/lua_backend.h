@@ -0,0 +1,164 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_LUA_BACKEND_H_
+#define CONFIGREADER_LUA_BACKEND_H_
+
+// The Lua implementation config files are evaluated with is chosen at build
+// time. Lua 5.2 is the default; define CONFIG_READER_LUA54 for Lua 5.4, or
+// CONFIG_READER_LUAJIT for LuaJIT 2.1, and link the matching library. The
+// helpers below cover the parts of the C API that differ between them.
+
+#include <cstddef>
+#include <type_traits>
+
+#if defined(CONFIG_READER_LUA54) && defined(CONFIG_READER_LUAJIT)
+#error "Define at most one of CONFIG_READER_LUA54 and CONFIG_READER_LUAJIT"
+#endif
+
+extern "C" {
+#if defined(CONFIG_READER_LUAJIT)
+#include "luajit-2.1/lauxlib.h"
+#include "luajit-2.1/lua.h"
+#include "luajit-2.1/luajit.h"
+#include "luajit-2.1/lualib.h"
+#elif defined(CONFIG_READER_LUA54)
+#include "lua5.4/lauxlib.h"
+#include "lua5.4/lua.h"
+#include "lua5.4/lualib.h"
+#else
+#include "lua5.2/lauxlib.h"
+#include "lua5.2/lua.h"
+#include "lua5.2/lualib.h"
+#endif
+}
+
+namespace config_reader {
+namespace lua_backend {
+
+#if defined(CONFIG_READER_LUAJIT)
+static constexpr char kName[] = "LuaJIT 2.1";
+#elif defined(CONFIG_READER_LUA54)
+static constexpr char kName[] = "Lua 5.4";
+#else
+static constexpr char kName[] = "Lua 5.2";
+#endif
+
+// Field of the package table listing the functions require searches with.
+#if LUA_VERSION_NUM >= 502
+static constexpr char kSearchersField[] = "searchers";
+#else
+static constexpr char kSearchersField[] = "loaders";
+#endif
+
+inline void PushGlobalTable(lua_State* L) {
+#if LUA_VERSION_NUM >= 502
+  lua_pushglobaltable(L);
+#else
+  lua_pushvalue(L, LUA_GLOBALSINDEX);
+#endif
+}
+
+// Length of the table or string at `index`, without invoking metamethods.
+inline size_t RawLength(lua_State* L, const int index) {
+#if LUA_VERSION_NUM >= 502
+  return static_cast<size_t>(lua_rawlen(L, index));
+#else
+  return lua_objlen(L, index);
+#endif
+}
+
+// Pops the table on top of the stack and makes it the environment of the
+// chunk at `index`, which must be below it.
+inline void SetChunkEnvironment(lua_State* L, const int index) {
+#if LUA_VERSION_NUM >= 502
+  // A chunk's only upvalue is its _ENV.
+  lua_setupvalue(L, index, 1);
+#else
+  lua_setfenv(L, index);
+#endif
+}
+
+// Whether the number at `index` is stored as an integer. Only Lua 5.3 and
+// later have an integer subtype.
+inline bool IsInteger(lua_State* L, const int index) {
+#if LUA_VERSION_NUM >= 503
+  return lua_isinteger(L, index) != 0;
+#else
+  (void)L;
+  (void)index;
+  return false;
+#endif
+}
+
+// Converts the number at `index` to T. Integers are read exactly where the
+// VM stores them natively, rather than by way of a double.
+template <typename T>
+inline T ToNumber(lua_State* L, const int index) {
+  if (std::is_integral<T>::value && IsInteger(L, index)) {
+    return static_cast<T>(lua_tointeger(L, index));
+  }
+  return static_cast<T>(lua_tonumber(L, index));
+}
+
+// Writes the function on top of the stack as a binary chunk, which
+// luaL_loadbuffer() accepts in place of source. Debug information is kept,
+// so errors still name the file and line.
+inline int Dump(lua_State* L, lua_Writer writer, void* data) {
+#if LUA_VERSION_NUM >= 503
+  return lua_dump(L, writer, data, 0);
+#else
+  return lua_dump(L, writer, data);
+#endif
+}
+
+// Turns LuaJIT's JIT compiler on or off. Hooks don't run in compiled code,
+// so it must be off for the instruction budget to hold. The interpreters
+// have nothing to turn off.
+inline void SetCompilerEnabled(lua_State* L, const bool enabled) {
+#if defined(CONFIG_READER_LUAJIT)
+  luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_FLUSH);
+  luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE |
+                           (enabled ? LUAJIT_MODE_ON : LUAJIT_MODE_OFF));
+#else
+  (void)L;
+  (void)enabled;
+#endif
+}
+
+// Creates a state allocating through `alloc`. LuaJIT builds without GC64
+// don't support custom allocators; they get a default state, which the
+// memory limit can't apply to.
+inline lua_State* NewState(lua_Alloc alloc, void* ud, bool* limited) {
+  lua_State* L = lua_newstate(alloc, ud);
+  *limited = L != nullptr;
+#if defined(CONFIG_READER_LUAJIT)
+  if (L == nullptr) {
+    L = luaL_newstate();
+  }
+#endif
+  return L;
+}
+
+}  // namespace lua_backend
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_LUA_BACKEND_H_
@@ -22,22 +22,106 @@
 #ifndef CONFIGREADER_LUA_SCRIPT_H_
 #define CONFIGREADER_LUA_SCRIPT_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
 #include <eigen3/Eigen/Core>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
-extern "C" {
-#include "lua5.2/lauxlib.h"
-#include "lua5.2/lua.h"
-#include "lua5.2/lualib.h"
-}
+#include "config_reader/chunk_cache.h"
+#include "config_reader/curve.h"
+#include "config_reader/file_dependencies.h"
+#include "config_reader/flat_map.h"
+#include "config_reader/lua_backend.h"
+#include "config_reader/mapped_array.h"
+#include "config_reader/value_text.h"
 
 static constexpr bool kDisableTopLevelMissingError = true;
 
 namespace config_reader {
 
+// Defaults for ScriptLimits. A well behaved config set uses a tiny fraction of
+// either, so hitting them almost always means a runaway loop or table.
+static constexpr size_t kDefaultMaxInstructions = 100000000;
+static constexpr size_t kDefaultMaxMemoryBytes = 256 * 1024 * 1024;
+// Number of VM instructions between checks of the instruction budget.
+static constexpr int kInstructionHookInterval = 1000;
+// Registry fields holding the environment the config files run in, and a
+// function that starts recording accesses to it afresh.
+static constexpr char kFileEnvironmentKey[] = "config_reader.environment";
+static constexpr char kResetEnvironmentKey[] = "config_reader.reset";
+// Creates the environment, given the globals and functions to call on the
+// first read and definition of each global by a file. The metamethods are in
+// Lua so that global accesses stay cheap, and can be JIT compiled.
+static constexpr char kEnvironmentSource[] = R"lua(
+local globals, note_read, note_define = ...
+local next, type = next, type
+local reads, defines = {}, {}
+local environment = {}
+setmetatable(environment, {
+  -- _G is the globals table itself, so raw access, pairs and metatables on it
+  -- work as usual. Accesses through it go untracked, see NoteRead.
+  __index = function(_, name)
+    local value = globals[name]
+    if type(name) == "string" and not reads[name] then
+      reads[name] = true
+      note_read(name, value)
+    end
+    return value
+  end,
+  __newindex = function(_, name, value)
+    globals[name] = value
+    if type(name) == "string" and not defines[name] then
+      defines[name] = true
+      note_define(name)
+    end
+  end,
+  -- So that pairs(_ENV) sees the globals.
+  __pairs = function()
+    return next, globals, nil
+  end,
+})
+return environment, function()
+  reads, defines = {}, {}
+end
+)lua";
+// Registry field holding the LuaScript, when the state's allocator can't.
+static constexpr char kScriptKey[] = "config_reader.script";
+
+// Bounds on a single evaluation of the config files. Evaluation that exceeds
+// either is aborted and the load is reported as failed. A max_instructions
+// of 0 means no budget; under LuaJIT that lets the files be JIT compiled,
+// which the instruction count hook otherwise prevents.
+struct ScriptLimits {
+  size_t max_instructions;
+  size_t max_memory_bytes;
+
+  ScriptLimits()
+      : max_instructions(kDefaultMaxInstructions),
+        max_memory_bytes(kDefaultMaxMemoryBytes) {}
+  ScriptLimits(const size_t& max_instructions, const size_t& max_memory_bytes)
+      : max_instructions(max_instructions),
+        max_memory_bytes(max_memory_bytes) {}
+};
+
 namespace util {
+// The error at the top of the stack. Lua can raise any value as an error,
+// not only a string.
+inline const char* ErrorMessage(lua_State* L) {
+  const char* message = lua_tostring(L, -1);
+  return message != nullptr ? message : "(error object is not a string)";
+}
+
 inline void StackDump(lua_State* L) {
   int top = lua_gettop(L);
   for (int i = 1; i <= top; i++) { /* repeat for each level */
@@ -70,20 +154,119 @@ inline T GetDefaultValue();
 
 class LuaScript {
   lua_State* lua_state_;
+  ScriptLimits limits_;
+  size_t memory_used_;
+  // Whether limits_.max_memory_bytes applies, which is only while the config
+  // files run. Anywhere else a refused allocation would raise outside any
+  // pcall, e.g. in luaL_openlibs, and Lua would abort the process.
+  bool memory_capped_;
+  size_t instructions_run_;
+  size_t num_errors_;
+  std::vector<std::string> watched_files_;
+  // Sorted names of the globals defined by the standard libraries.
+  std::vector<std::string> builtin_globals_;
+  std::vector<std::string> files_;
+  // Contents of files_ as last evaluated.
+  std::vector<std::string> sources_;
+  std::vector<FileAccesses> accesses_;
+  // Index of the file being evaluated, or -1.
+  int current_file_;
+  // Tables the current file read from other files' globals, serialized at
+  // the first read, to tell whether the file changed them in place.
+  std::map<std::string, std::string> read_tables_;
+  size_t files_evaluated_;
+  // Compiled files shared with other scripts, or null to parse every time.
+  std::shared_ptr<ChunkCache> chunks_;
+  // Files loaded with dofile, loadfile or require, with their contents as
+  // last read, and those already read during the current evaluation.
+  std::map<std::string, std::string> include_sources_;
+  std::set<std::string> includes_read_;
+  // Modules loaded by require, by name, with the file each came from.
+  std::map<std::string, std::string> modules_;
+  // Compiles included files: chunks_ if shared, otherwise a cache of the
+  // script's own, so that a file included by several config files is parsed
+  // once per change.
+  std::shared_ptr<ChunkCache> include_chunks_;
+  // Where messages about the files and their values go, or null for
+  // std::cout and std::cerr.
+  std::ostream* log_;
+
+  // Allocator handed to Lua which refuses to grow the state past
+  // limits_.max_memory_bytes. Lua turns the refusal into a memory error.
+  static void* LimitedAlloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+    LuaScript* script = static_cast<LuaScript*>(ud);
+    // When ptr is null, osize encodes the type of object being allocated.
+    const size_t old_size = (ptr == nullptr) ? 0 : osize;
+    if (nsize == 0) {
+      free(ptr);
+      script->memory_used_ -= old_size;
+      return nullptr;
+    }
+    if (script->memory_capped_ && nsize > old_size &&
+        script->memory_used_ + (nsize - old_size) >
+            script->limits_.max_memory_bytes) {
+      return nullptr;
+    }
+    void* new_ptr = realloc(ptr, nsize);
+    if (new_ptr == nullptr) {
+      return nullptr;
+    }
+    script->memory_used_ = script->memory_used_ - old_size + nsize;
+    return new_ptr;
+  }
+
+  // The LuaScript owning a state, which is the allocator's user data unless
+  // the backend couldn't use LimitedAlloc.
+  static LuaScript* FromState(lua_State* L) {
+    void* ud = nullptr;
+    if (lua_getallocf(L, &ud) != &LuaScript::LimitedAlloc) {
+      lua_getfield(L, LUA_REGISTRYINDEX, kScriptKey);
+      ud = lua_touserdata(L, -1);
+      lua_pop(L, 1);
+    }
+    return static_cast<LuaScript*>(ud);
+  }
+
+  // Count hook which aborts evaluation once the instruction budget is spent.
+  static void InstructionHook(lua_State* L, lua_Debug* /* ar */) {
+    LuaScript* script = FromState(L);
+    script->instructions_run_ += kInstructionHookInterval;
+    if (script->instructions_run_ > script->limits_.max_instructions) {
+      // Raise on every following instruction so that a pcall in the script
+      // can't swallow the error and keep running.
+      lua_sethook(L, &LuaScript::InstructionHook, LUA_MASKCOUNT, 1);
+      luaL_error(L, "instruction budget of %f exceeded",
+                 static_cast<lua_Number>(script->limits_.max_instructions));
+    }
+  }
+
+  std::ostream& InfoLog() { return log_ != nullptr ? *log_ : std::cout; }
 
   void ResetStack() { lua_pop(lua_state_, lua_gettop(lua_state_)); }
 
+  // Starts a new instruction budget for an evaluation.
+  void ResetInstructionBudget() {
+    instructions_run_ = 0;
+    if (limits_.max_instructions > 0) {
+      lua_sethook(lua_state_, &LuaScript::InstructionHook, LUA_MASKCOUNT,
+                  kInstructionHookInterval);
+    } else {
+      lua_sethook(lua_state_, nullptr, 0, 0);
+    }
+  }
+
   void Error(const std::string& variable_name, const std::string& reason,
-             const std::vector<std::string>& var_locations) const {
+             const std::vector<std::string>& var_locations) {
+    ++num_errors_;
     for (const auto& l : var_locations) {
-      std::cerr << l << ": Can't get [" << variable_name << "]. " << reason
+      ErrorLog() << l << ": Can't get [" << variable_name << "]. " << reason
                 << std::endl;
     }
   }
 
-  void Error(const std::string& variable_name,
-             const std::string& reason) const {
-    std::cerr << "Error: can't get [" << variable_name << "]. " << reason
+  void Error(const std::string& variable_name, const std::string& reason) {
+    ++num_errors_;
+    ErrorLog() << "Error: can't get [" << variable_name << "]. " << reason
               << std::endl;
   }
 
@@ -135,6 +318,270 @@ class LuaScript {
     return GetDefaultValue<T>();
   };
 
+  // Reads member `field` of the table on top of the stack into *value. Used by
+  // REFLECT_CONFIG_STRUCT; leaves *value untouched if the member is missing.
+  template <typename T>
+  void GetField(const std::string& variable_name, const char* field,
+                T* value) {
+    const int top = lua_gettop(lua_state_);
+    const std::string field_name = variable_name + "." + field;
+    lua_getfield(lua_state_, -1, field);
+    if (lua_isnil(lua_state_, -1)) {
+      Error(field_name, "Not defined");
+    } else {
+      *value = Get<T>(field_name);
+    }
+    lua_settop(lua_state_, top);
+  }
+
+  // Dictionary keys must already have the right Lua type; converting a key in
+  // place would break lua_next.
+  bool GetMapKey(const int index, std::string* key) {
+    if (lua_type(lua_state_, index) != LUA_TSTRING) {
+      return false;
+    }
+    *key = lua_tostring(lua_state_, index);
+    return true;
+  }
+
+  bool GetMapKey(const int index, int* key) {
+    if (lua_type(lua_state_, index) != LUA_TNUMBER) {
+      return false;
+    }
+    const lua_Number number = lua_tonumber(lua_state_, index);
+    // Converting a non-finite or out of range number to int is undefined.
+    if (!std::isfinite(number) || std::floor(number) != number ||
+        number < std::numeric_limits<int>::min() ||
+        number > std::numeric_limits<int>::max()) {
+      return false;
+    }
+    *key = static_cast<int>(number);
+    return true;
+  }
+
+  // The config file that last defined the global holding `variable_name`,
+  // or "" if none did.
+  std::string DefiningFile(const std::string& variable_name) const {
+    const std::string global = variable_name.substr(0, variable_name.find('.'));
+    for (size_t i = accesses_.size(); i-- > 0;) {
+      if (accesses_[i].defines.count(global) > 0) {
+        return files_[i];
+      }
+    }
+    return "";
+  }
+
+  // Reads the sidecar path of the array on top of the stack, either a path
+  // or a table {file = path, ...}. A relative path is taken relative to the
+  // config file that defined the variable and stored back in the Lua value
+  // as an absolute path, so that snapshots of the globals work from any
+  // directory. Returns false if there is no path.
+  bool ResolveFileValue(const std::string& variable_name, std::string* path) {
+    const int top = lua_gettop(lua_state_);
+    const bool is_string = lua_type(lua_state_, top) == LUA_TSTRING;
+    if (is_string) {
+      *path = lua_tostring(lua_state_, top);
+    } else if (lua_istable(lua_state_, top)) {
+      lua_getfield(lua_state_, top, "file");
+      if (lua_type(lua_state_, -1) == LUA_TSTRING) {
+        *path = lua_tostring(lua_state_, -1);
+      }
+      lua_pop(lua_state_, 1);
+    }
+    if (path->empty()) {
+      return false;
+    }
+    if ((*path)[0] == '/') {
+      return true;
+    }
+    *path = util::ResolvePath(DefiningFile(variable_name), *path);
+    // A path on its own is stored in the table holding it: the enclosing
+    // table or struct when there is one below it, otherwise the globals.
+    if (is_string) {
+      if (top >= 2) {
+        lua_pushvalue(lua_state_, top - 1);
+      } else {
+        lua_backend::PushGlobalTable(lua_state_);
+      }
+      const size_t dot = variable_name.rfind('.');
+      lua_pushstring(lua_state_, dot == std::string::npos
+                                     ? variable_name.c_str()
+                                     : variable_name.c_str() + dot + 1);
+    } else {
+      lua_pushvalue(lua_state_, top);
+      lua_pushstring(lua_state_, "file");
+    }
+    if (lua_istable(lua_state_, -2)) {
+      lua_pushstring(lua_state_, path->c_str());
+      lua_rawset(lua_state_, -3);
+    }
+    lua_settop(lua_state_, top);
+    return true;
+  }
+
+  // Accepts either a path, or a table {file = path, shape = {rows, ...}}.
+  template <typename T>
+  MappedArray<T> GetMappedArray(const std::string& variable_name) {
+    std::string path;
+    std::vector<size_t> shape;
+    ResolveFileValue(variable_name, &path);
+    if (lua_istable(lua_state_, -1)) {
+      lua_getfield(lua_state_, -1, "shape");
+      if (!lua_isnil(lua_state_, -1)) {
+        for (const unsigned int& dim :
+             Get<std::vector<unsigned int>>(variable_name + ".shape")) {
+          shape.push_back(dim);
+        }
+      }
+      lua_pop(lua_state_, 1);
+    }
+    if (path.empty()) {
+      Error(variable_name, "Not a file path or {file = path} table");
+      return GetDefault<MappedArray<T>>();
+    }
+    // Watch the file even if it fails to load, so fixing it triggers a reload.
+    watched_files_.push_back(path);
+    MappedArray<T> data;
+    std::string reason;
+    if (!data.Open(path, shape, &reason)) {
+      Error(variable_name, reason);
+      return GetDefault<MappedArray<T>>();
+    }
+    return data;
+  }
+
+  // Calls the function on top of the stack, below the curve table, at
+  // `samples` points from lower to upper. Pops the function.
+  bool SampleCurve(const std::string& variable_name, const float lower,
+                   const float upper, std::vector<float>* values) {
+    const int top = lua_gettop(lua_state_) - 1;
+    if (!lua_isfunction(lua_state_, -1)) {
+      lua_settop(lua_state_, top);
+      Error(variable_name, "fn is not a function");
+      return false;
+    }
+    lua_getfield(lua_state_, top, "samples");
+    const lua_Number samples = lua_tonumber(lua_state_, -1);
+    lua_pop(lua_state_, 1);
+    if (std::floor(samples) != samples || samples < 2 ||
+        samples > kMaxCurveSamples) {
+      lua_settop(lua_state_, top);
+      Error(variable_name, "samples must be an integer from 2 to " +
+                               std::to_string(kMaxCurveSamples));
+      return false;
+    }
+    const size_t count = static_cast<size_t>(samples);
+    values->resize(count);
+    const double step = (static_cast<double>(upper) - lower) / (count - 1);
+    for (size_t i = 0; i < count; ++i) {
+      lua_pushvalue(lua_state_, -1);
+      // The last point is exactly upper, whatever the rounding of step.
+      lua_pushnumber(lua_state_, i + 1 == count ? upper : lower + i * step);
+      if (lua_pcall(lua_state_, 1, 1, 0) != 0) {
+        Error(variable_name, std::string("fn failed: ") +
+                                 util::ErrorMessage(lua_state_));
+        lua_settop(lua_state_, top);
+        return false;
+      }
+      if (lua_type(lua_state_, -1) != LUA_TNUMBER) {
+        lua_settop(lua_state_, top);
+        Error(variable_name, "fn returned a non-number at sample " +
+                                 std::to_string(i));
+        return false;
+      }
+      (*values)[i] = lua_backend::ToNumber<float>(lua_state_, -1);
+      lua_pop(lua_state_, 1);
+    }
+    lua_settop(lua_state_, top);
+    return true;
+  }
+
+  // Appends the value on top of the stack in Lua literal syntax. Values with
+  // no literal form, such as functions, are written as nil and make this
+  // return false. `tables` holds the tables being written, to break cycles.
+  static bool SerializeValue(lua_State* L, std::vector<const void*>* tables,
+                             std::string* out) {
+    switch (lua_type(L, -1)) {
+      case LUA_TNUMBER:
+        if (lua_backend::IsInteger(L, -1)) {
+          out->append(std::to_string(lua_tointeger(L, -1)));
+        } else {
+          text::WriteNumber(lua_tonumber(L, -1), out);
+        }
+        return true;
+      case LUA_TBOOLEAN:
+        out->append(lua_toboolean(L, -1) ? "true" : "false");
+        return true;
+      case LUA_TSTRING: {
+        size_t length = 0;
+        const char* data = lua_tolstring(L, -1, &length);
+        text::WriteString(std::string(data, length), out);
+        return true;
+      }
+      case LUA_TTABLE: {
+        // Deeper tables couldn't be parsed back.
+        const void* table = lua_topointer(L, -1);
+        if (std::find(tables->begin(), tables->end(), table) !=
+                tables->end() ||
+            tables->size() >= static_cast<size_t>(text::kMaxNesting) ||
+            !lua_checkstack(L, 3)) {
+          break;
+        }
+        tables->push_back(table);
+        SerializeTable(L, tables, out);
+        tables->pop_back();
+        return true;
+      }
+      default:
+        break;
+    }
+    out->append("nil");
+    return false;
+  }
+
+  // List entries come first in order, then the other entries sorted by key so
+  // that equal tables always produce the same text.
+  static void SerializeTable(lua_State* L, std::vector<const void*>* tables,
+                             std::string* out) {
+    const int length = static_cast<int>(lua_backend::RawLength(L, -1));
+    out->push_back('{');
+    for (int i = 1; i <= length; ++i) {
+      out->append(i > 1 ? ", " : "");
+      lua_rawgeti(L, -1, i);
+      SerializeValue(L, tables, out);
+      lua_pop(L, 1);
+    }
+    std::vector<std::pair<std::string, std::string>> entries;
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+      std::string key;
+      if (lua_type(L, -2) == LUA_TSTRING) {
+        text::WriteKey(lua_tostring(L, -2), &key);
+      } else if (lua_type(L, -2) == LUA_TNUMBER) {
+        const lua_Number number = lua_tonumber(L, -2);
+        if (number >= 1 && number <= length && std::floor(number) == number) {
+          lua_pop(L, 1);
+          continue;
+        }
+        key.push_back('[');
+        text::WriteNumber(number, &key);
+        key.append("] = ");
+      }
+      std::string value;
+      if (!key.empty() && SerializeValue(L, tables, &value)) {
+        entries.emplace_back(key, value);
+      }
+      lua_pop(L, 1);
+    }
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i < entries.size(); ++i) {
+      out->append((i > 0 || length > 0) ? ", " : "");
+      out->append(entries[i].first);
+      out->append(entries[i].second);
+    }
+    out->push_back('}');
+  }
+
   void CleanupLuaState() {
     if (lua_state_) {
       lua_close(lua_state_);
@@ -142,26 +589,587 @@ class LuaScript {
     }
   }
 
- public:
-  LuaScript() : lua_state_(nullptr) {}
+  bool IsBuiltin(const std::string& name) const {
+    return std::binary_search(builtin_globals_.begin(), builtin_globals_.end(),
+                              name);
+  }
+
+  static LuaScript* FromUpvalue(lua_State* L) {
+    return static_cast<LuaScript*>(lua_touserdata(L, lua_upvalueindex(1)));
+  }
+
+  // Called on a file's first read of each global, with its name and value.
+  static int NoteRead(lua_State* L) {
+    LuaScript* script = FromUpvalue(L);
+    if (script->current_file_ < 0) {
+      return 0;
+    }
+    const std::string name = lua_tostring(L, 1);
+    FileAccesses& accesses = script->accesses_[script->current_file_];
+    if (name == "_G") {
+      accesses.uses_global_table = true;
+    }
+    lua_settop(L, 2);
+    if (accesses.defines.count(name) == 0 &&
+        accesses.reads.insert(name).second && lua_istable(L, 2) &&
+        !script->IsBuiltin(name)) {
+      std::vector<const void*> tables;
+      SerializeValue(L, &tables, &script->read_tables_[name]);
+    }
+    return 0;
+  }
+
+  // Called on a file's first definition of each global, with its name.
+  static int NoteDefine(lua_State* L) {
+    LuaScript* script = FromUpvalue(L);
+    if (script->current_file_ >= 0) {
+      script->accesses_[script->current_file_].defines.insert(
+          lua_tostring(L, 1));
+    }
+    return 0;
+  }
+
+  // Pushes the compiled file at `path`, or an error message, and returns
+  // whether it loaded. The file is read at most once per evaluation. Must not
+  // raise a Lua error, since C++ objects are live.
+  bool LoadInclude(const std::string& path) {
+    if (includes_read_.insert(path).second) {
+      std::ifstream file(path, std::ios::binary);
+      std::stringstream contents;
+      contents << file.rdbuf();
+      if (!file) {
+        includes_read_.erase(path);
+        lua_pushstring(lua_state_, ("cannot open " + path).c_str());
+        return false;
+      }
+      include_sources_[path] = contents.str();
+      watched_files_.push_back(path);
+    }
+    if (current_file_ >= 0) {
+      accesses_[current_file_].includes.insert(path);
+    }
+    return include_chunks_->Load(lua_state_, include_sources_[path],
+                                 "@" + path) == 0;
+  }
+
+  // Gives the function on top of the stack the environment config files run
+  // in, so that what an included file defines counts as defined by the file
+  // including it.
+  void SetFileEnvironment() {
+    lua_getfield(lua_state_, LUA_REGISTRYINDEX, kFileEnvironmentKey);
+    lua_backend::SetChunkEnvironment(lua_state_, -2);
+  }
+
+  // Replaces dofile(path), which runs the file and returns its results.
+  static int Dofile(lua_State* L) {
+    LuaScript* script = FromUpvalue(L);
+    luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+    if (!script->LoadInclude(lua_tostring(L, 1))) {
+      return lua_error(L);
+    }
+    script->SetFileEnvironment();
+    lua_call(L, 0, LUA_MULTRET);
+    return lua_gettop(L) - 1;
+  }
+
+  // Replaces loadfile(path [, mode [, env]]). The mode is ignored.
+  static int Loadfile(lua_State* L) {
+    LuaScript* script = FromUpvalue(L);
+    luaL_checkstring(L, 1);
+    const bool has_environment = !lua_isnone(L, 3);
+    lua_settop(L, 3);
+    if (!script->LoadInclude(lua_tostring(L, 1))) {
+      lua_pushnil(L);
+      lua_insert(L, -2);
+      return 2;
+    }
+    if (has_environment) {
+      lua_pushvalue(L, 3);
+      lua_backend::SetChunkEnvironment(L, -2);
+    } else {
+      script->SetFileEnvironment();
+    }
+    return 1;
+  }
+
+  // Replaces the searcher require uses for Lua files, with the package table
+  // as second upvalue. Finds the file along package.path as usual.
+  static int SearchModule(lua_State* L) {
+    LuaScript* script = FromUpvalue(L);
+    luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+    lua_getfield(L, lua_upvalueindex(2), "searchpath");
+    lua_pushvalue(L, 1);
+    lua_getfield(L, lua_upvalueindex(2), "path");
+    lua_call(L, 2, 2);
+    if (lua_isnil(L, 2)) {
+      // The message listing the paths tried.
+      return 1;
+    }
+    lua_pop(L, 1);
+    script->modules_[lua_tostring(L, 1)] = lua_tostring(L, 2);
+    if (!script->LoadInclude(lua_tostring(L, 2))) {
+      return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+                        lua_tostring(L, 1), lua_tostring(L, 2),
+                        lua_tostring(L, -1));
+    }
+    script->SetFileEnvironment();
+    lua_pushvalue(L, 2);
+    return 2;
+  }
+
+  // Wraps require, the second upvalue, so that a file requiring a module
+  // another file already loaded also counts as including it.
+  static int Require(lua_State* L) {
+    LuaScript* script = FromUpvalue(L);
+    luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+    lua_pushvalue(L, lua_upvalueindex(2));
+    lua_pushvalue(L, 1);
+    lua_call(L, 1, LUA_MULTRET);
+    script->NoteModule(lua_tostring(L, 1));
+    return lua_gettop(L) - 1;
+  }
+
+  void NoteModule(const char* name) {
+    const auto module = modules_.find(name);
+    if (module != modules_.end() && current_file_ >= 0) {
+      accesses_[current_file_].includes.insert(module->second);
+    }
+  }
+
+  // Routes dofile, loadfile and require through LoadInclude().
+  void InstallLoaders() {
+    lua_State* L = lua_state_;
+    lua_backend::PushGlobalTable(L);
+    lua_pushlightuserdata(L, this);
+    lua_pushcclosure(L, &LuaScript::Dofile, 1);
+    lua_setfield(L, -2, "dofile");
+    lua_pushlightuserdata(L, this);
+    lua_pushcclosure(L, &LuaScript::Loadfile, 1);
+    lua_setfield(L, -2, "loadfile");
+    lua_getfield(L, -1, "package");
+    lua_getfield(L, -1, lua_backend::kSearchersField);
+    if (lua_istable(L, -1)) {
+      // The second searcher is the one for Lua files.
+      lua_pushlightuserdata(L, this);
+      lua_pushvalue(L, -3);
+      lua_pushcclosure(L, &LuaScript::SearchModule, 2);
+      lua_rawseti(L, -2, 2);
+      lua_pushlightuserdata(L, this);
+      lua_getfield(L, -4, "require");
+      lua_pushcclosure(L, &LuaScript::Require, 2);
+      lua_setfield(L, -4, "require");
+    }
+    lua_pop(L, 3);
+  }
+
+  // Forgets the modules a file required, so that they run again when the
+  // file does.
+  void UnloadModules(const std::set<std::string>& includes) {
+    lua_getfield(lua_state_, LUA_REGISTRYINDEX, "_LOADED");
+    for (const auto& module : modules_) {
+      if (includes.count(module.second) > 0) {
+        lua_pushnil(lua_state_);
+        lua_setfield(lua_state_, -2, module.first.c_str());
+      }
+    }
+    lua_pop(lua_state_, 1);
+  }
+
+  // Reads the included files again, marking in *rerun the files that include
+  // one that changed.
+  void CheckIncludes(std::vector<bool>* rerun) {
+    includes_read_.clear();
+    std::set<std::string> changed;
+    for (auto& include : include_sources_) {
+      std::ifstream file(include.first, std::ios::binary);
+      std::stringstream contents;
+      contents << file.rdbuf();
+      if (!file) {
+        changed.insert(include.first);
+        continue;
+      }
+      if (contents.str() != include.second) {
+        changed.insert(include.first);
+        include.second = contents.str();
+      }
+      includes_read_.insert(include.first);
+      watched_files_.push_back(include.first);
+    }
+    for (size_t i = 0; i < files_.size(); ++i) {
+      if (util::Intersects(accesses_[i].includes, changed)) {
+        (*rerun)[i] = true;
+      }
+    }
+  }
+
+  // Drops the contents of files no longer included by any file.
+  void ForgetUnusedIncludes() {
+    std::set<std::string> used;
+    for (const FileAccesses& accesses : accesses_) {
+      used.insert(accesses.includes.begin(), accesses.includes.end());
+    }
+    for (auto it = include_sources_.begin(); it != include_sources_.end();) {
+      it = used.count(it->first) > 0 ? std::next(it)
+                                     : include_sources_.erase(it);
+    }
+  }
 
-  explicit LuaScript(const std::vector<std::string>& files)
-      : lua_state_(luaL_newstate()) {
+  // Creates a fresh state with the standard libraries. The config files run
+  // with an empty _ENV table that forwards to the globals, which lets each
+  // file's reads and definitions be recorded, see kEnvironmentSource.
+  bool Open() {
+    bool limited = false;
+    lua_state_ =
+        lua_backend::NewState(&LuaScript::LimitedAlloc, this, &limited);
+    if (lua_state_ == nullptr) {
+      InfoLog() << "Error: failed to create Lua state" << std::endl;
+      return false;
+    }
+    if (!limited) {
+      // The same for every state, so only worth saying once.
+      static std::atomic_bool warned(false);
+      if (!warned.exchange(true)) {
+        ErrorLog() << "Warning: " << lua_backend::kName
+                   << " can't limit memory use; ignoring max_memory_bytes"
+                   << std::endl;
+      }
+      lua_pushlightuserdata(lua_state_, this);
+      lua_setfield(lua_state_, LUA_REGISTRYINDEX, kScriptKey);
+    }
+    ResetInstructionBudget();
     luaL_openlibs(lua_state_);
-    for (const std::string& filename : files) {
-      if (luaL_loadfile(lua_state_, filename.c_str()) ||
-          lua_pcall(lua_state_, 0, 0, 0)) {
-        std::cout << "Error: failed to load (" << filename << ")" << std::endl;
-        std::cout << "Error Message: " << lua_tostring(lua_state_, -1)
-                  << std::endl;
+    lua_backend::SetCompilerEnabled(lua_state_, limits_.max_instructions == 0);
+    builtin_globals_.clear();
+    lua_backend::PushGlobalTable(lua_state_);
+    lua_pushnil(lua_state_);
+    while (lua_next(lua_state_, -2) != 0) {
+      if (lua_type(lua_state_, -2) == LUA_TSTRING) {
+        builtin_globals_.push_back(lua_tostring(lua_state_, -2));
+      }
+      lua_pop(lua_state_, 1);
+    }
+    lua_pop(lua_state_, 1);
+    std::sort(builtin_globals_.begin(), builtin_globals_.end());
+
+    if (luaL_loadbuffer(lua_state_, kEnvironmentSource,
+                        sizeof(kEnvironmentSource) - 1,
+                        "=config_reader") != 0) {
+      InfoLog() << "Error: " << util::ErrorMessage(lua_state_) << std::endl;
+      return false;
+    }
+    lua_backend::PushGlobalTable(lua_state_);
+    lua_pushlightuserdata(lua_state_, this);
+    lua_pushcclosure(lua_state_, &LuaScript::NoteRead, 1);
+    lua_pushlightuserdata(lua_state_, this);
+    lua_pushcclosure(lua_state_, &LuaScript::NoteDefine, 1);
+    if (lua_pcall(lua_state_, 3, 2, 0) != 0) {
+      InfoLog() << "Error: " << util::ErrorMessage(lua_state_) << std::endl;
+      return false;
+    }
+    lua_setfield(lua_state_, LUA_REGISTRYINDEX, kResetEnvironmentKey);
+    lua_setfield(lua_state_, LUA_REGISTRYINDEX, kFileEnvironmentKey);
+    InstallLoaders();
+    return true;
+  }
+
+  // Reads every file into sources_, marking in *changed those whose contents
+  // differ from the last evaluation.
+  bool ReadSources(std::vector<bool>* changed) {
+    changed->assign(files_.size(), true);
+    sources_.resize(files_.size());
+    for (size_t i = 0; i < files_.size(); ++i) {
+      std::ifstream file(files_[i], std::ios::binary);
+      std::stringstream contents;
+      contents << file.rdbuf();
+      if (!file) {
+        InfoLog() << "Error: failed to load (" << files_[i] << ")" << std::endl;
+        InfoLog() << "Error Message: cannot open " << files_[i] << std::endl;
+        return false;
+      }
+      (*changed)[i] = contents.str() != sources_[i];
+      sources_[i] = contents.str();
+    }
+    return true;
+  }
+
+  // Pushes the compiled file, or an error message.
+  int LoadChunk(const size_t index) {
+    const std::string chunk_name = "@" + files_[index];
+    if (chunks_) {
+      return chunks_->Load(lua_state_, sources_[index], chunk_name);
+    }
+    return luaL_loadbuffer(lua_state_, sources_[index].data(),
+                           sources_[index].size(), chunk_name.c_str());
+  }
+
+  bool RunFile(const size_t index) {
+    UnloadModules(accesses_[index].includes);
+    accesses_[index] = FileAccesses();
+    read_tables_.clear();
+    current_file_ = static_cast<int>(index);
+    lua_getfield(lua_state_, LUA_REGISTRYINDEX, kResetEnvironmentKey);
+    memory_capped_ = true;
+    bool ok = lua_pcall(lua_state_, 0, 0, 0) == 0 && LoadChunk(index) == 0;
+    if (ok) {
+      lua_getfield(lua_state_, LUA_REGISTRYINDEX, kFileEnvironmentKey);
+      lua_backend::SetChunkEnvironment(lua_state_, -2);
+      ok = lua_pcall(lua_state_, 0, 0, 0) == 0;
+    }
+    memory_capped_ = false;
+    current_file_ = -1;
+    if (!ok) {
+      InfoLog() << "Error: failed to load (" << files_[index] << ")"
+                << std::endl;
+      InfoLog() << "Error Message: " << util::ErrorMessage(lua_state_)
+                << std::endl;
+      return false;
+    }
+    // Changing another file's table in place counts as defining it.
+    for (const auto& read : read_tables_) {
+      lua_getglobal(lua_state_, read.first.c_str());
+      std::vector<const void*> tables;
+      std::string value;
+      SerializeValue(lua_state_, &tables, &value);
+      lua_pop(lua_state_, 1);
+      if (value != read.second) {
+        accesses_[index].defines.insert(read.first);
+      }
+    }
+    read_tables_.clear();
+    ++files_evaluated_;
+    return true;
+  }
+
+  void ClearGlobals(const std::set<std::string>& names) {
+    lua_backend::PushGlobalTable(lua_state_);
+    for (const std::string& name : names) {
+      lua_pushstring(lua_state_, name.c_str());
+      lua_pushnil(lua_state_);
+      lua_rawset(lua_state_, -3);
+    }
+    lua_pop(lua_state_, 1);
+  }
+
+  // Evaluates every file in order in a fresh state.
+  bool Evaluate() {
+    CleanupLuaState();
+    files_evaluated_ = 0;
+    watched_files_ = files_;
+    includes_read_.clear();
+    modules_.clear();
+    std::vector<bool> changed;
+    if (!ReadSources(&changed) || !Open()) {
+      CleanupLuaState();
+      return false;
+    }
+    accesses_.assign(files_.size(), FileAccesses());
+    for (size_t i = 0; i < files_.size(); ++i) {
+      if (!RunFile(i)) {
         CleanupLuaState();
-        break;
+        return false;
       }
     }
+    ForgetUnusedIncludes();
+    return true;
   }
 
+ public:
+  LuaScript()
+      : lua_state_(nullptr),
+        memory_used_(0),
+        memory_capped_(false),
+        instructions_run_(0),
+        num_errors_(0),
+        current_file_(-1),
+        files_evaluated_(0),
+        include_chunks_(new ChunkCache()),
+        log_(nullptr) {}
+
+  // Evaluates the files. Scripts given the same `chunks` share the work of
+  // parsing files they have in common. Errors are written to `log` if given.
+  explicit LuaScript(const std::vector<std::string>& files,
+                     const ScriptLimits& limits = ScriptLimits(),
+                     std::shared_ptr<ChunkCache> chunks = nullptr,
+                     std::ostream* log = nullptr)
+      : lua_state_(nullptr),
+        limits_(limits),
+        memory_used_(0),
+        memory_capped_(false),
+        instructions_run_(0),
+        num_errors_(0),
+        watched_files_(files),
+        files_(files),
+        current_file_(-1),
+        files_evaluated_(0),
+        chunks_(std::move(chunks)),
+        include_chunks_(chunks_ ? chunks_ : std::make_shared<ChunkCache>()),
+        log_(log) {
+    Evaluate();
+  }
+
+  // Brings the state up to date with the files. Only the files that changed
+  // are evaluated again, on top of the retained state, together with the
+  // files that read or redefine the globals they define. Falls back to
+  // evaluating every file when that can't reproduce an in order evaluation,
+  // e.g. when a file reads a global that a later file defines. Returns
+  // IsLoaded().
+  bool Update() {
+    if (lua_state_ == nullptr) {
+      return Evaluate();
+    }
+    files_evaluated_ = 0;
+    watched_files_ = files_;
+    ResetInstructionBudget();
+    std::vector<bool> rerun;
+    if (!ReadSources(&rerun)) {
+      CleanupLuaState();
+      return false;
+    }
+    CheckIncludes(&rerun);
+    if (std::find(rerun.begin(), rerun.end(), true) != rerun.end() &&
+        util::UsesGlobalTable(accesses_)) {
+      return Evaluate();
+    }
+    util::AddDependents(accesses_, util::DefinedBy(accesses_, rerun), &rerun);
+    std::set<std::string> cleared = util::DefinedBy(accesses_, rerun);
+    ClearGlobals(cleared);
+    for (size_t i = 0; i < files_.size(); ++i) {
+      if (!rerun[i]) {
+        continue;
+      }
+      if (!RunFile(i)) {
+        CleanupLuaState();
+        return false;
+      }
+      // Globals the file didn't define before bring in their own dependents.
+      std::set<std::string> added;
+      for (const std::string& name : accesses_[i].defines) {
+        if (cleared.insert(name).second) {
+          added.insert(name);
+        }
+      }
+      const std::vector<bool> scheduled = rerun;
+      util::AddDependents(accesses_, added, &rerun);
+      std::set<std::string> stale;
+      for (size_t j = 0; j < files_.size(); ++j) {
+        if (!rerun[j] || scheduled[j]) {
+          continue;
+        }
+        if (j < i) {
+          return Evaluate();
+        }
+        for (const std::string& name : accesses_[j].defines) {
+          if (cleared.insert(name).second) {
+            stale.insert(name);
+          }
+        }
+      }
+      ClearGlobals(stale);
+      if (util::SeesLaterDefinition(accesses_, rerun, i)) {
+        return Evaluate();
+      }
+    }
+    ForgetUnusedIncludes();
+    return true;
+  }
+
+  // The Lua state keeps a pointer to this object for its allocator.
+  LuaScript(const LuaScript&) = delete;
+  LuaScript& operator=(const LuaScript&) = delete;
+
   ~LuaScript() { CleanupLuaState(); }
 
+  // Where errors about the files and the values read from them are written.
+  std::ostream& ErrorLog() { return log_ != nullptr ? *log_ : std::cerr; }
+
+  // False if any file failed to load or exceeded the script limits.
+  bool IsLoaded() const { return lua_state_ != nullptr; }
+
+  // Each config file with a hash of the contents last evaluated, followed by
+  // the files they include.
+  std::vector<std::pair<std::string, uint64_t>> SourceHashes() const {
+    std::vector<std::pair<std::string, uint64_t>> hashes;
+    for (size_t i = 0; i < files_.size() && i < sources_.size(); ++i) {
+      hashes.emplace_back(files_[i], util::HashKey(sources_[i]));
+    }
+    for (const auto& include : include_sources_) {
+      hashes.emplace_back(include.first, util::HashKey(include.second));
+    }
+    return hashes;
+  }
+
+  // The files loaded with dofile, loadfile or require by the last evaluation.
+  std::vector<std::string> IncludedFiles() const {
+    std::vector<std::string> files;
+    for (const auto& include : include_sources_) {
+      files.push_back(include.first);
+    }
+    return files;
+  }
+
+  // Number of files evaluated by the constructor or the last Update().
+  size_t FilesEvaluated() const { return files_evaluated_; }
+
+  // Writes every global defined by the config files, apart from functions,
+  // as `name = value` lines in Lua literal syntax. Such a snapshot holds
+  // everything needed to resolve any key without evaluating the files again;
+  // see SnapshotRead().
+  bool SerializeGlobals(std::string* snapshot) {
+    if (lua_state_ == nullptr) {
+      return false;
+    }
+    std::vector<std::pair<std::string, std::string>> globals;
+    lua_backend::PushGlobalTable(lua_state_);
+    std::vector<const void*> tables(1, lua_topointer(lua_state_, -1));
+    lua_pushnil(lua_state_);
+    while (lua_next(lua_state_, -2) != 0) {
+      if (lua_type(lua_state_, -2) == LUA_TSTRING) {
+        const std::string name = lua_tostring(lua_state_, -2);
+        std::string value;
+        if (!std::binary_search(builtin_globals_.begin(),
+                                builtin_globals_.end(), name) &&
+            SerializeValue(lua_state_, &tables, &value)) {
+          globals.emplace_back(name, value);
+        }
+      }
+      lua_pop(lua_state_, 1);
+    }
+    lua_pop(lua_state_, 1);
+    std::sort(globals.begin(), globals.end());
+    snapshot->clear();
+    for (const auto& global : globals) {
+      text::WriteKey(global.first, snapshot);
+      snapshot->append(global.second);
+      snapshot->push_back('\n');
+    }
+    return true;
+  }
+
+  // Stores the sidecar path of each of the array `keys` as an absolute path,
+  // as reading them would, see ResolveFileValue(). Done before serializing
+  // the globals, so that snapshots name the files the publisher reads.
+  void ResolveFilePaths(const std::vector<std::string>& keys) {
+    if (lua_state_ == nullptr) {
+      return;
+    }
+    for (const std::string& key : keys) {
+      std::string path;
+      if (LoadStackLocation(key, {})) {
+        ResolveFileValue(key, &path);
+      }
+      ResetStack();
+    }
+  }
+
+  // The config files, the files they include, and every file referenced by
+  // variables read so far.
+  const std::vector<std::string>& WatchedFiles() const {
+    return watched_files_;
+  }
+
   template <typename T>
   std::pair<bool, T> GetVariable(
       const std::string& variable_name,
@@ -176,9 +1184,12 @@ class LuaScript {
       return {false, GetDefault<T>()};
     }
 
+    // A conversion error anywhere in the value, e.g. one bad list element,
+    // leaves the variable at its previous value.
+    const size_t prior_errors = num_errors_;
     const T result = Get<T>(variable_name);
     ResetStack();
-    return {true, result};
+    return {num_errors_ == prior_errors, result};
   }
 };
 
@@ -189,7 +1200,7 @@ class LuaScript {
       Error(variable_name, "Not a number");                            \
       return GetDefault<Type>();                                       \
     }                                                                  \
-    return static_cast<Type>(lua_tonumber(lua_state_, -1));            \
+    return lua_backend::ToNumber<Type>(lua_state_, -1);                \
   }
 
 #define GET_NUMBER_LIST(Type)                                              \
@@ -200,7 +1211,8 @@ class LuaScript {
       Error(variable_name, "Not a std::vector<Type>");                     \
       return GetDefault<std::vector<Type>>();                              \
     }                                                                      \
-    const int table_length = static_cast<int>(lua_rawlen(lua_state_, -1)); \
+    const int table_length =                                               \
+        static_cast<int>(lua_backend::RawLength(lua_state_, -1));          \
     std::vector<Type> data;                                                \
     for (int i = 1; i <= table_length; ++i) {                              \
       lua_pushinteger(lua_state_, i);                                      \
@@ -209,7 +1221,7 @@ class LuaScript {
         Error(variable_name, "Element not a Type");                        \
         return GetDefault<std::vector<Type>>();                            \
       }                                                                    \
-      data.push_back(static_cast<Type>(lua_tonumber(lua_state_, -1)));     \
+      data.push_back(lua_backend::ToNumber<Type>(lua_state_, -1));         \
       lua_pop(lua_state_, 1);                                              \
     }                                                                      \
     return data;                                                           \
@@ -223,7 +1235,8 @@ class LuaScript {
       Error(variable_name, "Not a std::vector<Type>");                     \
       return GetDefault<std::vector<Type>>();                              \
     }                                                                      \
-    const int table_length = static_cast<int>(lua_rawlen(lua_state_, -1)); \
+    const int table_length =                                               \
+        static_cast<int>(lua_backend::RawLength(lua_state_, -1));          \
     std::vector<Type> data;                                                \
     for (int i = 1; i <= table_length; ++i) {                              \
       lua_pushinteger(lua_state_, i);                                      \
@@ -234,6 +1247,37 @@ class LuaScript {
     return data;                                                           \
   }
 
+#define GET_MAP(KeyType, ValueType)                                         \
+  template <>                                                               \
+  inline FlatMap<KeyType, ValueType>                                        \
+  LuaScript::Get<FlatMap<KeyType, ValueType>>(                              \
+      const std::string& variable_name) {                                   \
+    if (!lua_istable(lua_state_, -1)) {                                     \
+      Error(variable_name, "Not a map of " #KeyType " to " #ValueType);     \
+      return GetDefault<FlatMap<KeyType, ValueType>>();                     \
+    }                                                                       \
+    std::vector<std::pair<KeyType, ValueType>> data;                        \
+    lua_pushnil(lua_state_);                                                \
+    while (lua_next(lua_state_, -2) != 0) {                                 \
+      const int top = lua_gettop(lua_state_);                               \
+      KeyType key;                                                          \
+      if (!GetMapKey(-2, &key)) {                                           \
+        Error(variable_name, "Key not a valid " #KeyType);                  \
+        return GetDefault<FlatMap<KeyType, ValueType>>();                   \
+      }                                                                     \
+      data.emplace_back(key, Get<ValueType>(variable_name + " entry"));     \
+      lua_settop(lua_state_, top - 1);                                      \
+    }                                                                       \
+    return FlatMap<KeyType, ValueType>(std::move(data));                    \
+  }
+
+#define GET_MAPPED_ARRAY(Type)                                         \
+  template <>                                                          \
+  inline MappedArray<Type> LuaScript::Get<MappedArray<Type>>(          \
+      const std::string& variable_name) {                              \
+    return GetMappedArray<Type>(variable_name);                        \
+  }
+
 GET_NUMBER(float);
 
 GET_NUMBER(int);
@@ -276,7 +1320,8 @@ inline std::vector<std::string> LuaScript::Get<std::vector<std::string>>(
     Error(variable_name, "Not a std::vector<std::string>");
     return GetDefault<std::vector<std::string>>();
   }
-  const int table_length = static_cast<int>(lua_rawlen(lua_state_, -1));
+  const int table_length =
+      static_cast<int>(lua_backend::RawLength(lua_state_, -1));
   std::vector<std::string> data;
   for (int i = 1; i <= table_length; ++i) {
     lua_pushinteger(lua_state_, i);
@@ -298,7 +1343,8 @@ inline std::vector<bool> LuaScript::Get<std::vector<bool>>(
     Error(variable_name, "Not a std::vector<bool>");
     return GetDefault<std::vector<bool>>();
   }
-  const int table_length = static_cast<int>(lua_rawlen(lua_state_, -1));
+  const int table_length =
+      static_cast<int>(lua_backend::RawLength(lua_state_, -1));
   std::vector<bool> data;
   for (int i = 1; i <= table_length; ++i) {
     lua_pushinteger(lua_state_, i);
@@ -320,7 +1366,8 @@ inline Eigen::Vector2f LuaScript::Get<Eigen::Vector2f>(
     Error(variable_name, "Not a std::vector<bool>");
     return GetDefault<Eigen::Vector2f>();
   }
-  const int table_length = static_cast<int>(lua_rawlen(lua_state_, -1));
+  const int table_length =
+      static_cast<int>(lua_backend::RawLength(lua_state_, -1));
   if (table_length != 2) {
     Error(variable_name, "Wrong number of entries for Vector2f (" +
                              std::to_string(table_length) + ")");
@@ -347,7 +1394,8 @@ inline Eigen::Vector3f LuaScript::Get<Eigen::Vector3f>(
     Error(variable_name, "Not a std::vector<bool>");
     return GetDefault<Eigen::Vector3f>();
   }
-  const int table_length = static_cast<int>(lua_rawlen(lua_state_, -1));
+  const int table_length =
+      static_cast<int>(lua_backend::RawLength(lua_state_, -1));
   if (table_length != 3) {
     Error(variable_name, "Wrong number of entries for Vector3f (" +
                              std::to_string(table_length) + ")");
@@ -371,6 +1419,72 @@ GET_OBJECT_LIST(Eigen::Vector2f);
 
 GET_OBJECT_LIST(Eigen::Vector3f);
 
+GET_MAP(std::string, int);
+
+GET_MAP(std::string, double);
+
+GET_MAP(std::string, float);
+
+GET_MAP(std::string, std::string);
+
+GET_MAP(std::string, bool);
+
+GET_MAP(int, int);
+
+GET_MAP(int, double);
+
+GET_MAP(int, std::string);
+
+GET_MAPPED_ARRAY(float);
+
+GET_MAPPED_ARRAY(double);
+
+GET_MAPPED_ARRAY(int);
+
+// Accepts either {fn = function(x) ... end, domain = {lower, upper},
+// samples = n}, sampling fn at n evenly spaced points, or samples given
+// directly as {domain = {lower, upper}, values = {...}}. Sampling counts
+// towards the instruction budget.
+template <>
+inline Curve LuaScript::Get<Curve>(const std::string& variable_name) {
+  if (!lua_istable(lua_state_, -1)) {
+    Error(variable_name, "Not a table");
+    return GetDefault<Curve>();
+  }
+  lua_getfield(lua_state_, -1, "domain");
+  const std::vector<float> domain =
+      lua_isnil(lua_state_, -1)
+          ? std::vector<float>()
+          : Get<std::vector<float>>(variable_name + ".domain");
+  lua_pop(lua_state_, 1);
+  if (domain.size() != 2) {
+    Error(variable_name, "Needs domain = {lower, upper}");
+    return GetDefault<Curve>();
+  }
+  std::vector<float> values;
+  lua_getfield(lua_state_, -1, "fn");
+  if (lua_isnil(lua_state_, -1)) {
+    lua_pop(lua_state_, 1);
+    lua_getfield(lua_state_, -1, "values");
+    if (lua_isnil(lua_state_, -1)) {
+      lua_pop(lua_state_, 1);
+      Error(variable_name, "Needs either fn or values");
+      return GetDefault<Curve>();
+    }
+    values = Get<std::vector<float>>(variable_name + ".values");
+    lua_pop(lua_state_, 1);
+  } else if (!SampleCurve(variable_name, domain[0], domain[1], &values)) {
+    return GetDefault<Curve>();
+  }
+  Curve curve;
+  std::string reason;
+  if (!curve.Set(domain[0], domain[1], std::move(values), &reason)) {
+    Error(variable_name, reason);
+    return GetDefault<Curve>();
+  }
+  return curve;
+}
+
 }  // namespace config_reader
 
 #endif  // CONFIGREADER_LUA_SCRIPT_H_
@@ -24,11 +24,15 @@
 
 #include <atomic>
 #include <memory>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "config_reader/profile.h"
 #include "config_reader/types/config_generic.h"
 #include "config_reader/types/config_numeric.h"
+#include "config_reader/types/config_struct.h"
 #include "config_reader/types/type_interface.h"
 
 namespace config_reader {
@@ -41,11 +45,20 @@ namespace config_reader {
 
 #define MAKE_NAME(name) CONFIG_##name
 
+#ifdef CONFIG_READER_PROFILE
+#define MAKE_MACRO(name, key, cpptype, configtype)                         \
+  static const ::config_reader::ProfiledRef<cpptype> MAKE_NAME(name)(      \
+      ::config_reader::InitVar<cpptype,                                    \
+                               ::config_reader::config_types::configtype>( \
+          key, LOCATION),                                                  \
+      key, LOCATION)
+#else
 #define MAKE_MACRO(name, key, cpptype, configtype)                         \
   static const cpptype& MAKE_NAME(name) =                                  \
       ::config_reader::InitVar<cpptype,                                    \
                                ::config_reader::config_types::configtype>( \
           key, LOCATION)
+#endif
 
 // Define macros for creating new config vars
 // clang-format off
@@ -65,40 +78,99 @@ namespace config_reader {
 #define CONFIG_VECTOR3F(name, key) MAKE_MACRO(name, key, Eigen::Vector3f, ConfigVector3f)
 #define CONFIG_VECTOR2FLIST(name, key) MAKE_MACRO(name, key, std::vector<Eigen::Vector2f>, ConfigVector2fList)
 #define CONFIG_VECTOR3FLIST(name, key) MAKE_MACRO(name, key, std::vector<Eigen::Vector3f>, ConfigVector3fList)
+#define CONFIG_STRINGINTMAP(name, key) MAKE_MACRO(name, key, ::config_reader::StringIntMap, ConfigStringIntMap)
+#define CONFIG_STRINGDOUBLEMAP(name, key) MAKE_MACRO(name, key, ::config_reader::StringDoubleMap, ConfigStringDoubleMap)
+#define CONFIG_STRINGFLOATMAP(name, key) MAKE_MACRO(name, key, ::config_reader::StringFloatMap, ConfigStringFloatMap)
+#define CONFIG_STRINGSTRINGMAP(name, key) MAKE_MACRO(name, key, ::config_reader::StringStringMap, ConfigStringStringMap)
+#define CONFIG_STRINGBOOLMAP(name, key) MAKE_MACRO(name, key, ::config_reader::StringBoolMap, ConfigStringBoolMap)
+#define CONFIG_INTINTMAP(name, key) MAKE_MACRO(name, key, ::config_reader::IntIntMap, ConfigIntIntMap)
+#define CONFIG_INTDOUBLEMAP(name, key) MAKE_MACRO(name, key, ::config_reader::IntDoubleMap, ConfigIntDoubleMap)
+#define CONFIG_INTSTRINGMAP(name, key) MAKE_MACRO(name, key, ::config_reader::IntStringMap, ConfigIntStringMap)
+#define CONFIG_FLOATARRAY(name, key) MAKE_MACRO(name, key, ::config_reader::FloatArray, ConfigFloatArray)
+#define CONFIG_DOUBLEARRAY(name, key) MAKE_MACRO(name, key, ::config_reader::DoubleArray, ConfigDoubleArray)
+#define CONFIG_INTARRAY(name, key) MAKE_MACRO(name, key, ::config_reader::IntArray, ConfigIntArray)
+#define CONFIG_CURVE(name, key) MAKE_MACRO(name, key, ::config_reader::Curve, ConfigCurve)
+// The struct type must first be declared with REFLECT_CONFIG_STRUCT.
+#define CONFIG_STRUCT(name, key, cpptype) MAKE_MACRO(name, key, cpptype, ConfigStruct<cpptype>)
 // clang-format on
 
-class MapSingleton {
-  static constexpr int kNumMapBuckets = 1000000;
+// The C++ type of the values held by a config_types class.
+template <typename ConfigType>
+using ConfigValueType = typename std::decay<
+    decltype(std::declval<ConfigType&>().GetValue())>::type;
+
+// The variables bound to one set of config files, by key. The CONFIG_*
+// macros bind to the process-wide Default() registry. A program that runs
+// several independently configured instances in one process, such as a
+// simulator with many robots, gives each instance its own registry; see
+// ConfigReaderOptions::registry and ConfigGroup.
+class Registry {
+  static constexpr int kNumDefaultBuckets = 1000000;
 
  public:
   using KeyLookupMap =
       std::unordered_map<std::string,
                          std::unique_ptr<config_types::TypeInterface>>;
 
-  static KeyLookupMap& Singleton() {
-    static KeyLookupMap config(kNumMapBuckets);
-    return config;
+ private:
+  KeyLookupMap keys_;
+  std::atomic_bool new_key_added_;
+  std::atomic_bool initialized_;
+
+ public:
+  Registry() : new_key_added_(false), initialized_(false) {}
+  explicit Registry(const size_t num_buckets)
+      : keys_(num_buckets), new_key_added_(false), initialized_(false) {}
+  Registry(const Registry&) = delete;
+  Registry& operator=(const Registry&) = delete;
+
+  static Registry& Default() {
+    static Registry registry(kNumDefaultBuckets);
+    return registry;
   }
 
+  KeyLookupMap& Keys() { return keys_; }
+
+  // Set when a key is bound, and cleared when the registry is next loaded.
+  std::atomic_bool* NewKeyAdded() { return &new_key_added_; }
+
+  // Set once a reader has started loading into the registry.
+  std::atomic_bool* Initialized() { return &initialized_; }
+
+  // Binds `key` in this registry, e.g. Bind<config_types::ConfigFloat>("kp"),
+  // like a CONFIG_* macro does in the default one. The reference stays valid
+  // as long as the registry.
+  template <typename ConfigType>
+  const ConfigValueType<ConfigType>& Bind(
+      const std::string& key, const std::string& var_location = "");
+};
+
+// The default registry, under its original name.
+class MapSingleton {
+ public:
+  using KeyLookupMap = Registry::KeyLookupMap;
+
+  static KeyLookupMap& Singleton() { return Registry::Default().Keys(); }
+
   static std::atomic_bool* NewKeyAdded() {
-    static std::atomic_bool new_key_added(false);
-    return &new_key_added;
+    return Registry::Default().NewKeyAdded();
   }
 
   static std::atomic_bool* ConfigInitialized() {
-    static std::atomic_bool config_initialized(false);
-    return &config_initialized;
+    return Registry::Default().Initialized();
   }
 };
 
 template <typename CPPType, typename ConfigType>
-const CPPType& InitVar(const std::string& key,
+const CPPType& InitVar(Registry* registry, const std::string& key,
                        const std::string& var_location) {
-  auto& map = MapSingleton::Singleton();
+  auto& map = registry->Keys();
   auto find_res = map.find(key);
   if (find_res != map.end()) {
     config_types::TypeInterface* ti = find_res->second.get();
-    if (ti->GetType() != ConfigType::GetEnumType()) {
+    // Every struct shares CSTRUCT, so also check the concrete class.
+    if (ti->GetType() != ConfigType::GetEnumType() ||
+        dynamic_cast<ConfigType*>(ti) == nullptr) {
       std::cerr << "Mismatch of types for key " << key
                 << ". Existing type: " << ti->GetType()
                 << ", requested type: " << ConfigType::GetEnumType()
@@ -114,11 +186,24 @@ const CPPType& InitVar(const std::string& key,
     std::cerr << "Creation of " << key << " failed!" << std::endl;
     exit(1);
   }
-  *MapSingleton::NewKeyAdded() = true;
+  *registry->NewKeyAdded() = true;
   config_types::TypeInterface* ti = insert_res.first->second.get();
   ti->AddVarLocation(var_location);
   return static_cast<ConfigType*>(ti)->GetValue();
 }
+
+template <typename CPPType, typename ConfigType>
+const CPPType& InitVar(const std::string& key,
+                       const std::string& var_location) {
+  return InitVar<CPPType, ConfigType>(&Registry::Default(), key, var_location);
+}
+
+template <typename ConfigType>
+const ConfigValueType<ConfigType>& Registry::Bind(
+    const std::string& key, const std::string& var_location) {
+  return InitVar<ConfigValueType<ConfigType>, ConfigType>(this, key,
+                                                          var_location);
+}
 }  // namespace config_reader
 
 #endif  // CONFIGREADER_MACROS_H_
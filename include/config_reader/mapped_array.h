@@ -0,0 +1,312 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_MAPPED_ARRAY_H_
+#define CONFIGREADER_MAPPED_ARRAY_H_
+
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace config_reader {
+
+namespace util {
+// `path` made absolute relative to the directory of `file`, e.g. a sidecar
+// file named by a config file. Absolute paths are returned unchanged.
+inline std::string ResolvePath(const std::string& file,
+                               const std::string& path) {
+  if (path.empty() || path[0] == '/') {
+    return path;
+  }
+  const size_t slash = file.rfind('/');
+  std::string directory = slash == std::string::npos
+                              ? "."
+                              : file.substr(0, std::max<size_t>(slash, 1));
+  char* real = realpath(directory.c_str(), nullptr);
+  if (real != nullptr) {
+    directory = real;
+    free(real);
+  }
+  return (directory == "/" ? "" : directory) + "/" + path;
+}
+
+// Read-only, shared mapping of a whole file. Unmapped on destruction.
+class MappedFile {
+  const char* data_;
+  size_t size_;
+
+ public:
+  MappedFile() : data_(nullptr), size_(0) {}
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  bool Open(const std::string& path, std::string* error) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      *error = "Couldn't open " + path + ": " + strerror(errno);
+      return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+      *error = "Couldn't stat " + path + ": " + strerror(errno);
+      close(fd);
+      return false;
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+      if (data == MAP_FAILED) {
+        *error = "Couldn't map " + path + ": " + strerror(errno);
+        close(fd);
+        return false;
+      }
+      data_ = static_cast<const char*>(data);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    return true;
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+};
+
+// Element type codes as written in the 'descr' field of .npy headers.
+template <typename T>
+inline const char* NpyTypeCode();
+template <>
+inline const char* NpyTypeCode<float>() {
+  return "f4";
+}
+template <>
+inline const char* NpyTypeCode<double>() {
+  return "f8";
+}
+template <>
+inline const char* NpyTypeCode<int>() {
+  return "i4";
+}
+
+// Returns the text following `'field':` in a .npy header dict, or an empty
+// string if the field is missing.
+inline std::string NpyHeaderField(const std::string& header,
+                                  const std::string& field) {
+  const size_t pos = header.find("'" + field + "'");
+  if (pos == std::string::npos) {
+    return "";
+  }
+  const size_t colon = header.find(':', pos);
+  if (colon == std::string::npos) {
+    return "";
+  }
+  size_t start = colon + 1;
+  while (start < header.size() && header[start] == ' ') {
+    ++start;
+  }
+  return header.substr(start);
+}
+}  // namespace util
+
+// Typed, read-only view of an array stored in a binary file next to the
+// config, mapped into memory rather than copied. The file is either a .npy
+// file (version 1-3, C order, native byte order) or raw packed elements, in
+// which case the shape comes from the config or defaults to one dimension.
+//
+// Copies share the mapping, which is released when the last copy is
+// destroyed; hold a copy rather than a raw pointer to keep the data alive
+// across reloads.
+//
+// Sidecar files must be replaced by writing a new file and renaming it over
+// the old one. Rewriting a file in place, e.g. np.save() to the same path,
+// truncates it under every process that has it mapped, and their next read
+// of the array dies with SIGBUS. A private mapping wouldn't help: pages that
+// were never written still read through to the file.
+template <typename T>
+class MappedArray {
+  std::shared_ptr<const util::MappedFile> file_;
+  const T* data_;
+  size_t size_;
+  std::vector<size_t> shape_;
+  std::string path_;
+
+  static size_t NumElements(const std::vector<size_t>& shape) {
+    size_t n = 1;
+    for (const size_t& dim : shape) {
+      n *= dim;
+    }
+    return n;
+  }
+
+  // Parses the .npy header, returning the offset of the array data.
+  static bool ParseNpyHeader(const util::MappedFile& file,
+                             std::vector<size_t>* shape, size_t* offset,
+                             std::string* error) {
+    const unsigned char* bytes =
+        reinterpret_cast<const unsigned char*>(file.data());
+    const unsigned char major_version = bytes[6];
+    size_t header_length = 0;
+    if (major_version == 1) {
+      header_length = bytes[8] | (bytes[9] << 8);
+      *offset = 10;
+    } else if (major_version == 2 || major_version == 3) {
+      if (file.size() < 12) {
+        *error = "Truncated .npy header";
+        return false;
+      }
+      header_length = bytes[8] | (bytes[9] << 8) | (bytes[10] << 16) |
+                      (static_cast<size_t>(bytes[11]) << 24);
+      *offset = 12;
+    } else {
+      *error = "Unsupported .npy version " + std::to_string(major_version);
+      return false;
+    }
+    if (*offset + header_length > file.size()) {
+      *error = "Truncated .npy header";
+      return false;
+    }
+    const std::string header(file.data() + *offset, header_length);
+    *offset += header_length;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const char kNativeOrder = '<';
+#else
+    const char kNativeOrder = '>';
+#endif
+    const std::string descr = util::NpyHeaderField(header, "descr");
+    const std::string type_code = util::NpyTypeCode<T>();
+    if (descr.size() < 5 ||
+        (descr[1] != kNativeOrder && descr[1] != '=') ||
+        descr.compare(2, type_code.size(), type_code) != 0 ||
+        descr[2 + type_code.size()] != descr[0]) {
+      *error = "Element type " + descr.substr(0, descr.find(',')) +
+               " doesn't match expected " + type_code;
+      return false;
+    }
+    if (util::NpyHeaderField(header, "fortran_order").compare(0, 4, "True") ==
+        0) {
+      *error = "Fortran order arrays are not supported";
+      return false;
+    }
+    const std::string shape_text = util::NpyHeaderField(header, "shape");
+    if (shape_text.empty() || shape_text[0] != '(') {
+      *error = "Missing shape in .npy header";
+      return false;
+    }
+    shape->clear();
+    const char* c = shape_text.c_str() + 1;
+    while (*c != ')' && *c != '\0') {
+      char* end = nullptr;
+      const unsigned long long dim = strtoull(c, &end, 10);
+      if (end == c) {
+        ++c;
+        continue;
+      }
+      shape->push_back(static_cast<size_t>(dim));
+      c = end;
+    }
+    return true;
+  }
+
+ public:
+  MappedArray() : data_(nullptr), size_(0) {}
+
+  // Maps the file at `path`. If `expected_shape` is non-empty, the array
+  // must have exactly that shape.
+  bool Open(const std::string& path, const std::vector<size_t>& expected_shape,
+            std::string* error) {
+    std::shared_ptr<util::MappedFile> file(new util::MappedFile());
+    if (!file->Open(path, error)) {
+      return false;
+    }
+    static const char kNpyMagic[] = "\x93NUMPY";
+    std::vector<size_t> shape = expected_shape;
+    size_t offset = 0;
+    if (file->size() >= 10 && memcmp(file->data(), kNpyMagic, 6) == 0) {
+      if (!ParseNpyHeader(*file, &shape, &offset, error)) {
+        *error = path + ": " + *error;
+        return false;
+      }
+      if (!expected_shape.empty() && shape != expected_shape) {
+        *error = path + ": Shape doesn't match the configured shape";
+        return false;
+      }
+    } else if (shape.empty()) {
+      if (file->size() % sizeof(T) != 0) {
+        *error = path + ": Size is not a multiple of the element size";
+        return false;
+      }
+      shape.push_back(file->size() / sizeof(T));
+    }
+    const size_t size = NumElements(shape);
+    if (file->size() - offset != size * sizeof(T)) {
+      *error = path + ": Expected " + std::to_string(size * sizeof(T)) +
+               " bytes of data, found " + std::to_string(file->size() - offset);
+      return false;
+    }
+    file_ = file;
+    data_ = reinterpret_cast<const T*>(file_->data() + offset);
+    size_ = size;
+    shape_ = shape;
+    path_ = path;
+    return true;
+  }
+
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const std::vector<size_t>& shape() const { return shape_; }
+  const std::string& path() const { return path_; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+  const T& operator[](const size_t i) const { return data_[i]; }
+  // Row major access into a two dimensional array.
+  const T& operator()(const size_t row, const size_t col) const {
+    assert(shape_.size() == 2);
+    assert(row < shape_[0] && col < shape_[1]);
+    return data_[row * shape_[1] + col];
+  }
+};
+
+using FloatArray = MappedArray<float>;
+using DoubleArray = MappedArray<double>;
+using IntArray = MappedArray<int>;
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_MAPPED_ARRAY_H_
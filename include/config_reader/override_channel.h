@@ -0,0 +1,372 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_OVERRIDE_CHANNEL_H_
+#define CONFIGREADER_OVERRIDE_CHANNEL_H_
+
+extern "C" {
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+}
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "config_reader/macros.h"
+#include "config_reader/types/type_interface.h"
+
+namespace config_reader {
+
+// Serves live overrides over a Unix stream socket, bypassing Lua entirely.
+// Requests and replies are single lines:
+//
+//   get <key>            -> ok <value>
+//   set <key> <value>    -> ok
+//   begin                -> ok       start a batch
+//   set <key> <value>    -> ok       checked and queued until commit
+//   commit               -> ok <n>   apply every queued set, or none
+//   abort                -> ok       drop the queued sets
+//
+// Values use the same syntax as Lua literals, e.g. `set speeds {1.5, 2}`, and
+// go through the same type and bounds checks as values read from the files.
+// Failures reply `error <reason>` and leave the variable unchanged. Overrides
+// last until the files are next reloaded.
+//
+// The server is driven by whoever polls fd(), so all writes to variables
+// happen on that thread. Those writes are one variable at a time, so a
+// thread reading variables meanwhile can see part of a batch, just as it can
+// see part of a reload. A server created with `stage` set instead stages
+// values like StageRead() and leaves applying them, all at once, to its
+// owner; ConfigReader does so with ConfigReaderOptions::manual_commit.
+class OverrideServer {
+  static constexpr int kMaxEvents = 16;
+  static constexpr size_t kReadSize = 4096;
+  static constexpr size_t kMaxLineLength = 1024 * 1024;
+
+  struct Client {
+    std::string input;
+    bool in_batch;
+    bool batch_failed;
+    std::vector<std::pair<config_types::TypeInterface*, std::string>> batch;
+
+    Client() : in_batch(false), batch_failed(false) {}
+  };
+
+  Registry* registry_;
+  const bool stage_;
+  std::string path_;
+  int listen_fd_;
+  int epoll_fd_;
+  std::unordered_map<int, Client> clients_;
+  // Variables set since the start of ProcessEvents().
+  std::vector<config_types::TypeInterface*> changed_;
+
+  config_types::TypeInterface* Find(const std::string& key) {
+    auto& map = registry_->Keys();
+    const auto it = map.find(key);
+    return it == map.end() ? nullptr : it->second.get();
+  }
+
+  // Splits off the first space separated word of *rest.
+  static std::string NextWord(std::string* rest) {
+    const size_t begin = rest->find_first_not_of(' ');
+    if (begin == std::string::npos) {
+      rest->clear();
+      return "";
+    }
+    const size_t end = rest->find(' ', begin);
+    std::string word = rest->substr(begin, end - begin);
+    *rest = end == std::string::npos ? "" : rest->substr(end + 1);
+    return word;
+  }
+
+  // Applies or stages a value, see the class comment.
+  bool Apply(config_types::TypeInterface* t, const std::string& value,
+             std::string* error) {
+    const char* begin = value.data();
+    const char* end = begin + value.size();
+    return stage_ ? t->StageValueText(begin, end, error)
+                  : t->SetValueText(begin, end, error);
+  }
+
+  std::string Set(Client* client, const std::string& key,
+                  const std::string& value) {
+    config_types::TypeInterface* t = Find(key);
+    if (t == nullptr) {
+      if (client->in_batch) {
+        client->batch_failed = true;
+      }
+      return "error unknown key " + key;
+    }
+    const char* begin = value.data();
+    const char* end = begin + value.size();
+    std::string error;
+    if (client->in_batch) {
+      if (!t->CheckValueText(begin, end, &error)) {
+        client->batch_failed = true;
+        return "error " + error;
+      }
+      client->batch.emplace_back(t, value);
+      return "ok";
+    }
+    if (!Apply(t, value, &error)) {
+      return "error " + error;
+    }
+    changed_.push_back(t);
+    return "ok";
+  }
+
+  std::string Commit(Client* client) {
+    if (!client->in_batch) {
+      return "error no batch in progress";
+    }
+    client->in_batch = false;
+    if (client->batch_failed) {
+      client->batch.clear();
+      return "error batch had errors, nothing applied";
+    }
+    // Every value was checked when it was queued, so these can't fail.
+    std::string error;
+    for (const auto& set : client->batch) {
+      Apply(set.first, set.second, &error);
+      changed_.push_back(set.first);
+    }
+    const size_t count = client->batch.size();
+    client->batch.clear();
+    return "ok " + std::to_string(count);
+  }
+
+  std::string Execute(Client* client, std::string line) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    const std::string command = NextWord(&line);
+    if (command == "get") {
+      const std::string key = NextWord(&line);
+      const config_types::TypeInterface* t = Find(key);
+      if (t == nullptr) {
+        return "error unknown key " + key;
+      }
+      return "ok " + t->GetValueText();
+    }
+    if (command == "set") {
+      const std::string key = NextWord(&line);
+      return Set(client, key, line);
+    }
+    if (command == "begin") {
+      if (client->in_batch) {
+        return "error batch already in progress";
+      }
+      client->in_batch = true;
+      client->batch_failed = false;
+      return "ok";
+    }
+    if (command == "commit") {
+      return Commit(client);
+    }
+    if (command == "abort") {
+      client->in_batch = false;
+      client->batch.clear();
+      return "ok";
+    }
+    return "error unknown command " + command;
+  }
+
+  void Accept() {
+    while (true) {
+      const int fd = accept4(listen_fd_, nullptr, nullptr,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        return;
+      }
+      epoll_event event = {};
+      event.data.fd = fd;
+      event.events = EPOLLIN;
+      if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+        close(fd);
+        continue;
+      }
+      clients_[fd];
+    }
+  }
+
+  void Disconnect(const int fd) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    clients_.erase(fd);
+  }
+
+  static bool Reply(const int fd, const std::string& reply) {
+    const std::string line = reply + "\n";
+    size_t sent = 0;
+    while (sent < line.size()) {
+      const ssize_t n =
+          send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      sent += n;
+    }
+    return true;
+  }
+
+  void Serve(const int fd) {
+    Client& client = clients_[fd];
+    char buffer[kReadSize];
+    while (true) {
+      const ssize_t n = read(fd, buffer, sizeof(buffer));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        break;
+      }
+      if (n <= 0) {
+        Disconnect(fd);
+        return;
+      }
+      client.input.append(buffer, n);
+    }
+    size_t begin = 0;
+    size_t end;
+    while ((end = client.input.find('\n', begin)) != std::string::npos) {
+      const std::string line = client.input.substr(begin, end - begin);
+      begin = end + 1;
+      if (!Reply(fd, Execute(&client, line))) {
+        Disconnect(fd);
+        return;
+      }
+    }
+    client.input.erase(0, begin);
+    if (client.input.size() > kMaxLineLength) {
+      Reply(fd, "error line too long");
+      Disconnect(fd);
+    }
+  }
+
+ public:
+  // Serves the variables of `registry`, staging values if `stage` is set.
+  explicit OverrideServer(Registry* registry = &Registry::Default(),
+                          const bool stage = false)
+      : registry_(registry), stage_(stage), listen_fd_(-1), epoll_fd_(-1) {}
+  OverrideServer(const OverrideServer&) = delete;
+  OverrideServer& operator=(const OverrideServer&) = delete;
+  ~OverrideServer() { Close(); }
+
+  // Listens on `path`, replacing a socket left behind by an earlier server.
+  // Fails rather than replace anything else. Only the owner of the process
+  // may connect.
+  bool Open(const std::string& path, std::string* error) {
+    Close();
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+      *error = "Invalid socket path " + path;
+      return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    struct stat existing;
+    if (lstat(path.c_str(), &existing) == 0) {
+      if (!S_ISSOCK(existing.st_mode)) {
+        *error = "Won't replace " + path + ", which is not a socket";
+        return false;
+      }
+      unlink(path.c_str());
+    }
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event event = {};
+    event.data.fd = listen_fd_;
+    event.events = EPOLLIN;
+    // Nobody can connect before listen(), so restricting the socket between
+    // bind() and listen() leaves no window.
+    if (listen_fd_ < 0 || epoll_fd_ < 0 ||
+        bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) != 0 ||
+        chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+        listen(listen_fd_, SOMAXCONN) != 0 ||
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event) != 0) {
+      *error = "Couldn't listen on " + path + ": " + strerror(errno);
+      Close();
+      return false;
+    }
+    path_ = path;
+    return true;
+  }
+
+  void Close() {
+    for (const auto& client : clients_) {
+      close(client.first);
+    }
+    clients_.clear();
+    if (listen_fd_ >= 0) {
+      close(listen_fd_);
+      listen_fd_ = -1;
+    }
+    if (epoll_fd_ >= 0) {
+      close(epoll_fd_);
+      epoll_fd_ = -1;
+    }
+    if (!path_.empty()) {
+      unlink(path_.c_str());
+      path_.clear();
+    }
+  }
+
+  bool IsOpen() const { return listen_fd_ >= 0; }
+
+  // Becomes readable when there are connections or requests to serve.
+  int fd() const { return epoll_fd_; }
+
+  // Serves whatever is ready without blocking. If given, *changed is set to
+  // the variables that were set or staged, in order. A variable set twice
+  // appears twice.
+  void ProcessEvents(
+      std::vector<config_types::TypeInterface*>* changed = nullptr) {
+    changed_.clear();
+    epoll_event events[kMaxEvents];
+    const int n = epoll_wait(epoll_fd_, events, kMaxEvents, 0);
+    for (int i = 0; i < n; ++i) {
+      if (events[i].data.fd == listen_fd_) {
+        Accept();
+      } else {
+        Serve(events[i].data.fd);
+      }
+    }
+    if (changed != nullptr) {
+      changed->swap(changed_);
+    }
+  }
+};
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_OVERRIDE_CHANNEL_H_
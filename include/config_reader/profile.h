@@ -0,0 +1,355 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_PROFILE_H_
+#define CONFIGREADER_PROFILE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace config_reader {
+
+#ifdef CONFIG_READER_PROFILE
+static constexpr bool kProfilingEnabled = true;
+#else
+static constexpr bool kProfilingEnabled = false;
+#endif
+
+#ifndef CONFIG_READER_PROFILE_INTERVAL
+#define CONFIG_READER_PROFILE_INTERVAL 64
+#endif
+// Average number of reads per sample. Each thread samples after a random
+// number of reads, so that loops reading keys in a fixed order don't always
+// credit the same key.
+static constexpr uint32_t kProfileSampleInterval =
+    CONFIG_READER_PROFILE_INTERVAL;
+
+namespace profile {
+
+// A place a variable was declared, i.e. one of a key's var_locations_.
+struct Site {
+  const size_t id;
+  const std::string key;
+  const std::string location;
+  // Set by the first read, so keys read too rarely to be sampled still count
+  // as read.
+  std::atomic_bool read;
+
+  Site(const size_t id, const std::string& key, const std::string& location)
+      : id(id), key(key), location(location), read(false) {}
+};
+
+// Sampled read counts of one thread, indexed by site id. Only the owning
+// thread writes them, so increments needn't be atomic read-modify-writes.
+class ThreadCounters {
+  static constexpr size_t kChunkSize = 1024;
+  static constexpr size_t kMaxChunks = 256;
+
+  std::atomic<std::atomic<uint64_t>*> chunks_[kMaxChunks];
+
+ public:
+  ThreadCounters() {
+    for (size_t i = 0; i < kMaxChunks; ++i) {
+      chunks_[i].store(nullptr);
+    }
+  }
+  ~ThreadCounters() {
+    for (size_t i = 0; i < kMaxChunks; ++i) {
+      delete[] chunks_[i].load();
+    }
+  }
+
+  void Add(const size_t site, const uint64_t count) {
+    if (site >= kChunkSize * kMaxChunks) {
+      return;
+    }
+    std::atomic<uint64_t>* chunk =
+        chunks_[site / kChunkSize].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+      chunk = new std::atomic<uint64_t>[kChunkSize];
+      for (size_t i = 0; i < kChunkSize; ++i) {
+        chunk[i].store(0, std::memory_order_relaxed);
+      }
+      chunks_[site / kChunkSize].store(chunk, std::memory_order_release);
+    }
+    std::atomic<uint64_t>& counter = chunk[site % kChunkSize];
+    counter.store(counter.load(std::memory_order_relaxed) + count,
+                  std::memory_order_relaxed);
+  }
+
+  uint64_t Get(const size_t site) const {
+    if (site >= kChunkSize * kMaxChunks) {
+      return 0;
+    }
+    const std::atomic<uint64_t>* chunk =
+        chunks_[site / kChunkSize].load(std::memory_order_acquire);
+    return chunk == nullptr
+               ? 0
+               : chunk[site % kChunkSize].load(std::memory_order_relaxed);
+  }
+};
+
+// Every site and every thread's counters. Counters outlive their threads,
+// so that reads by finished threads still show up.
+class Registry {
+  std::mutex mutex_;
+  std::deque<Site> sites_;
+  std::vector<std::unique_ptr<ThreadCounters>> counters_;
+
+ public:
+  static Registry& Get() {
+    static Registry registry;
+    return registry;
+  }
+
+  Site* AddSite(const std::string& key, const std::string& location) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sites_.emplace_back(sites_.size(), key, location);
+    return &sites_.back();
+  }
+
+  ThreadCounters* AddThread() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    counters_.emplace_back(new ThreadCounters());
+    return counters_.back().get();
+  }
+
+  // Calls f(site, estimated_reads) for every site.
+  template <typename Function>
+  void ForEachSite(Function f) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Site& site : sites_) {
+      uint64_t reads = 0;
+      for (const auto& counters : counters_) {
+        reads += counters->Get(site.id);
+      }
+      f(site, reads);
+    }
+  }
+};
+
+// Trivially constructed, so using it needs no thread_local init guard.
+struct ThreadState {
+  uint32_t countdown;
+  // Reads the current countdown started from.
+  uint32_t interval;
+  uint32_t random;
+  ThreadCounters* counters;
+};
+
+inline ThreadState& LocalState() {
+  static thread_local ThreadState state = {1, 1, 0, nullptr};
+  return state;
+}
+
+inline void Sample(ThreadState* state, const Site* site) {
+  if (state->counters == nullptr) {
+    state->counters = Registry::Get().AddThread();
+    state->random = static_cast<uint32_t>(
+        reinterpret_cast<uintptr_t>(state->counters) >> 4) | 1;
+  }
+  state->counters->Add(site->id, state->interval);
+  // xorshift32
+  state->random ^= state->random << 13;
+  state->random ^= state->random >> 17;
+  state->random ^= state->random << 5;
+  state->interval = 1 + state->random % (2 * kProfileSampleInterval - 1);
+  state->countdown = state->interval;
+}
+
+inline void NoteRead(Site* site) {
+  if (!site->read.load(std::memory_order_relaxed)) {
+    site->read.store(true, std::memory_order_relaxed);
+  }
+  ThreadState& state = LocalState();
+  if (--state.countdown == 0) {
+    Sample(&state, site);
+  }
+}
+
+}  // namespace profile
+
+// The members of a struct declared with REFLECT_CONFIG_STRUCT, as seen
+// through a ProfiledRef. Other types have none.
+template <typename T>
+class ProfiledFields {
+ public:
+  ProfiledFields(const T&, profile::Site*) {}
+};
+
+// Forwards the const member function `name` of the referenced value,
+// counting a read.
+#define PROFILED_REF_METHOD(name)                                        \
+  template <typename... Args, typename U = T>                            \
+  auto name(Args&&... args) const                                        \
+      -> decltype(std::declval<const U&>().name(                         \
+          std::forward<Args>(args)...)) {                                \
+    return get().name(std::forward<Args>(args)...);                      \
+  }
+
+// Stands in for the `const T&` of a CONFIG_* variable when built with
+// CONFIG_READER_PROFILE, counting reads. It converts to `const T&` wherever
+// that is expected, and forwards the members call sites use: the member
+// functions of the types the CONFIG_* macros declare, and the fields of
+// reflected structs. Anything else is reached through `->` or get().
+template <typename T>
+class ProfiledRef : public ProfiledFields<T> {
+  const T& value_;
+  profile::Site* const site_;
+
+ public:
+  ProfiledRef(const T& value, const std::string& key,
+              const std::string& location)
+      : ProfiledRef(value, profile::Registry::Get().AddSite(key, location)) {}
+  // Counts reads against an existing site, e.g. that of the enclosing struct.
+  ProfiledRef(const T& value, profile::Site* site)
+      : ProfiledFields<T>(value, site), value_(value), site_(site) {}
+
+  const T& get() const {
+    profile::NoteRead(site_);
+    return value_;
+  }
+  operator const T&() const { return get(); }
+  const T* operator->() const { return &get(); }
+
+  template <typename Index>
+  auto operator[](Index&& index) const
+      -> decltype(std::declval<const T&>()[std::forward<Index>(index)]) {
+    return get()[std::forward<Index>(index)];
+  }
+  template <typename... Args>
+  auto operator()(Args&&... args) const
+      -> decltype(std::declval<const T&>()(std::forward<Args>(args)...)) {
+    return get()(std::forward<Args>(args)...);
+  }
+  template <typename U = T>
+  auto begin() const -> decltype(std::declval<const U&>().begin()) {
+    return get().begin();
+  }
+  // Not counted, so that a range based for loop counts as one read.
+  template <typename U = T>
+  auto end() const -> decltype(std::declval<const U&>().end()) {
+    return value_.end();
+  }
+  template <typename U = T>
+  auto size() const -> decltype(std::declval<const U&>().size()) {
+    return get().size();
+  }
+  template <typename U = T>
+  auto empty() const -> decltype(std::declval<const U&>().empty()) {
+    return get().empty();
+  }
+
+  // std::vector and std::string.
+  PROFILED_REF_METHOD(at)
+  PROFILED_REF_METHOD(front)
+  PROFILED_REF_METHOD(back)
+  PROFILED_REF_METHOD(data)
+  PROFILED_REF_METHOD(c_str)
+  PROFILED_REF_METHOD(length)
+  PROFILED_REF_METHOD(find)
+  PROFILED_REF_METHOD(substr)
+  PROFILED_REF_METHOD(compare)
+  // FlatMap, MappedArray and Curve.
+  PROFILED_REF_METHOD(Find)
+  PROFILED_REF_METHOD(Contains)
+  PROFILED_REF_METHOD(Get)
+  PROFILED_REF_METHOD(shape)
+  PROFILED_REF_METHOD(path)
+  PROFILED_REF_METHOD(lower)
+  PROFILED_REF_METHOD(upper)
+  // Eigen vectors.
+  PROFILED_REF_METHOD(x)
+  PROFILED_REF_METHOD(y)
+  PROFILED_REF_METHOD(z)
+  PROFILED_REF_METHOD(norm)
+  PROFILED_REF_METHOD(squaredNorm)
+  PROFILED_REF_METHOD(normalized)
+  PROFILED_REF_METHOD(dot)
+  PROFILED_REF_METHOD(cross)
+  PROFILED_REF_METHOD(transpose)
+};
+#undef PROFILED_REF_METHOD
+
+// Operators of class types, like std::string, are templates that won't
+// convert a ProfiledRef implicitly.
+#define PROFILED_REF_OPERATOR(op)                                       \
+  template <typename T, typename U>                                     \
+  auto operator op(const ProfiledRef<T>& a, const U& b)                 \
+      -> decltype(a.get() op b) {                                       \
+    return a.get() op b;                                                \
+  }                                                                     \
+  template <typename T, typename U>                                     \
+  auto operator op(const U& a, const ProfiledRef<T>& b)                 \
+      -> decltype(a op b.get()) {                                       \
+    return a op b.get();                                                \
+  }                                                                     \
+  template <typename T, typename U>                                     \
+  auto operator op(const ProfiledRef<T>& a, const ProfiledRef<U>& b)    \
+      -> decltype(a.get() op b.get()) {                                 \
+    return a.get() op b.get();                                          \
+  }
+
+PROFILED_REF_OPERATOR(==)
+PROFILED_REF_OPERATOR(!=)
+PROFILED_REF_OPERATOR(<)
+PROFILED_REF_OPERATOR(>)
+PROFILED_REF_OPERATOR(<=)
+PROFILED_REF_OPERATOR(>=)
+PROFILED_REF_OPERATOR(+)
+PROFILED_REF_OPERATOR(-)
+PROFILED_REF_OPERATOR(*)
+PROFILED_REF_OPERATOR(/)
+#undef PROFILED_REF_OPERATOR
+
+template <typename T>
+std::ostream& operator<<(std::ostream& stream, const ProfiledRef<T>& ref) {
+  return stream << ref.get();
+}
+
+// Read counts of one declaration site. Reads are estimated from samples, but
+// `read` is exact.
+struct SiteProfile {
+  std::string key;
+  std::string location;
+  uint64_t estimated_reads;
+  bool read;
+};
+
+inline std::vector<SiteProfile> ProfileSites() {
+  std::vector<SiteProfile> sites;
+  profile::Registry::Get().ForEachSite(
+      [&sites](const profile::Site& site, const uint64_t reads) {
+        sites.push_back({site.key, site.location, reads, site.read.load()});
+      });
+  return sites;
+}
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_PROFILE_H_
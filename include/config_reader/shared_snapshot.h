@@ -0,0 +1,260 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_SHARED_SNAPSHOT_H_
+#define CONFIGREADER_SHARED_SNAPSHOT_H_
+
+extern "C" {
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace config_reader {
+
+static constexpr uint64_t kSnapshotMagic = 0x31504e5347464343ULL;  // CCFGSNP1
+static constexpr uint32_t kSnapshotFormatVersion = 1;
+static constexpr size_t kDefaultSnapshotCapacity = 16 * 1024 * 1024;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "Snapshot segments need lock free 64 bit atomics");
+
+// Start of a shared memory segment holding a config snapshot; the snapshot
+// text follows directly after. The publisher brackets each write by
+// incrementing `sequence`, so it is odd while a write is in progress and
+// subscribers retry reads that overlap a write. `magic` is cleared when the
+// segment is abandoned, telling subscribers to open the segment again.
+struct SnapshotSegmentHeader {
+  std::atomic<uint64_t> magic;
+  uint32_t format_version;
+  uint32_t reserved;
+  uint64_t capacity;
+  std::atomic<uint64_t> sequence;
+  std::atomic<uint64_t> generation;
+  std::atomic<uint64_t> size;
+};
+
+// Writes snapshots to a named POSIX shared memory segment. There must be at
+// most one publisher per segment name.
+class SnapshotPublisher {
+  std::string name_;
+  SnapshotSegmentHeader* header_;
+  size_t mapped_size_;
+
+  static void Retire(const std::string& name) {
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      return;
+    }
+    struct stat segment_stat;
+    if (fstat(fd, &segment_stat) == 0 &&
+        static_cast<size_t>(segment_stat.st_size) >=
+            sizeof(SnapshotSegmentHeader)) {
+      void* data = mmap(nullptr, sizeof(SnapshotSegmentHeader),
+                        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (data != MAP_FAILED) {
+        static_cast<SnapshotSegmentHeader*>(data)->magic.store(0);
+        munmap(data, sizeof(SnapshotSegmentHeader));
+      }
+    }
+    close(fd);
+    shm_unlink(name.c_str());
+  }
+
+ public:
+  SnapshotPublisher() : header_(nullptr), mapped_size_(0) {}
+  SnapshotPublisher(const SnapshotPublisher&) = delete;
+  SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+  ~SnapshotPublisher() {
+    if (header_ != nullptr) {
+      // If a newer publisher retired this segment, the name is now its.
+      if (header_->magic.exchange(0) == kSnapshotMagic) {
+        shm_unlink(name_.c_str());
+      }
+      munmap(header_, mapped_size_);
+    }
+  }
+
+  // Creates a fresh segment, replacing any left behind by an earlier
+  // publisher. `name` follows shm_open() rules, e.g. "/robot_config".
+  bool Open(const std::string& name, const size_t capacity,
+            std::string* error) {
+    Retire(name);
+    const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+      *error = "Couldn't create shared memory " + name + ": " + strerror(errno);
+      return false;
+    }
+    const size_t mapped_size = sizeof(SnapshotSegmentHeader) + capacity;
+    if (ftruncate(fd, mapped_size) != 0) {
+      *error = "Couldn't size shared memory " + name + ": " + strerror(errno);
+      close(fd);
+      shm_unlink(name.c_str());
+      return false;
+    }
+    void* data = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      *error = "Couldn't map shared memory " + name + ": " + strerror(errno);
+      shm_unlink(name.c_str());
+      return false;
+    }
+    name_ = name;
+    mapped_size_ = mapped_size;
+    // The segment starts out zeroed, so only the constant fields need
+    // setting before the magic number makes it visible.
+    header_ = static_cast<SnapshotSegmentHeader*>(data);
+    header_->format_version = kSnapshotFormatVersion;
+    header_->capacity = capacity;
+    header_->magic.store(kSnapshotMagic, std::memory_order_release);
+    return true;
+  }
+
+  bool Publish(const std::string& snapshot, std::string* error) {
+    if (header_ == nullptr) {
+      *error = "Publisher is not open";
+      return false;
+    }
+    if (snapshot.size() > header_->capacity) {
+      *error = "Snapshot of " + std::to_string(snapshot.size()) +
+               " bytes exceeds the segment capacity of " +
+               std::to_string(header_->capacity);
+      return false;
+    }
+    const uint64_t sequence = header_->sequence.load(std::memory_order_relaxed);
+    header_->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(reinterpret_cast<char*>(header_ + 1), snapshot.data(),
+           snapshot.size());
+    header_->size.store(snapshot.size(), std::memory_order_relaxed);
+    header_->generation.fetch_add(1, std::memory_order_relaxed);
+    header_->sequence.store(sequence + 2, std::memory_order_release);
+    return true;
+  }
+};
+
+// Maps a segment written by a SnapshotPublisher read-only.
+class SnapshotSubscriber {
+  static constexpr int kMaxReadAttempts = 100;
+
+  const SnapshotSegmentHeader* header_;
+  size_t mapped_size_;
+
+  void Close() {
+    if (header_ != nullptr) {
+      munmap(const_cast<SnapshotSegmentHeader*>(header_), mapped_size_);
+      header_ = nullptr;
+    }
+  }
+
+ public:
+  SnapshotSubscriber() : header_(nullptr), mapped_size_(0) {}
+  SnapshotSubscriber(const SnapshotSubscriber&) = delete;
+  SnapshotSubscriber& operator=(const SnapshotSubscriber&) = delete;
+  ~SnapshotSubscriber() { Close(); }
+
+  // False until a publisher has created the segment.
+  bool Open(const std::string& name, std::string* error) {
+    Close();
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+      *error = "Couldn't open shared memory " + name + ": " + strerror(errno);
+      return false;
+    }
+    struct stat segment_stat;
+    if (fstat(fd, &segment_stat) != 0 ||
+        static_cast<size_t>(segment_stat.st_size) <
+            sizeof(SnapshotSegmentHeader)) {
+      *error = "Shared memory " + name + " is not a config snapshot";
+      close(fd);
+      return false;
+    }
+    const size_t mapped_size = segment_stat.st_size;
+    void* data = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+      *error = "Couldn't map shared memory " + name + ": " + strerror(errno);
+      return false;
+    }
+    header_ = static_cast<const SnapshotSegmentHeader*>(data);
+    mapped_size_ = mapped_size;
+    if (header_->magic.load(std::memory_order_acquire) != kSnapshotMagic ||
+        header_->format_version != kSnapshotFormatVersion ||
+        sizeof(SnapshotSegmentHeader) + header_->capacity > mapped_size_) {
+      *error = "Shared memory " + name + " is not a current config snapshot";
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  // True while the segment is open and its publisher hasn't abandoned it.
+  bool IsOpen() const {
+    return header_ != nullptr &&
+           header_->magic.load(std::memory_order_relaxed) == kSnapshotMagic;
+  }
+
+  // Copies out the snapshot if its generation differs from *generation, and
+  // updates *generation. Returns false if there is nothing new to read.
+  bool Read(uint64_t* generation, std::string* snapshot) const {
+    if (!IsOpen()) {
+      return false;
+    }
+    const char* payload = reinterpret_cast<const char*>(header_ + 1);
+    for (int attempt = 0; attempt < kMaxReadAttempts; ++attempt) {
+      const uint64_t sequence =
+          header_->sequence.load(std::memory_order_acquire);
+      if (sequence % 2 == 1) {
+        sched_yield();
+        continue;
+      }
+      const uint64_t current =
+          header_->generation.load(std::memory_order_relaxed);
+      if (current == *generation) {
+        return false;
+      }
+      const uint64_t size = header_->size.load(std::memory_order_relaxed);
+      if (size > header_->capacity) {
+        continue;
+      }
+      snapshot->assign(payload, size);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header_->sequence.load(std::memory_order_relaxed) == sequence) {
+        *generation = current;
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_SHARED_SNAPSHOT_H_
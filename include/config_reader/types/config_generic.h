@@ -22,6 +22,8 @@
 #ifndef CONFIGREADER_TYPES_CONFIG_GENERIC_H_
 #define CONFIGREADER_TYPES_CONFIG_GENERIC_H_
 
+#include "config_reader/flat_map.h"
+#include "config_reader/mapped_array.h"
 #include "config_reader/types/type_interface.h"
 
 #include <eigen3/Eigen/Core>
@@ -32,18 +34,48 @@
   class ClassName : public TypeInterface {                          \
    public:                                                          \
     ClassName(const std::string& key)                               \
-        : TypeInterface(key, Type::EnumName), val_(DefaultValue) {} \
+        : TypeInterface(key, Type::EnumName),                       \
+          val_(DefaultValue),                                       \
+          pending_(DefaultValue) {}                                 \
                                                                     \
     ClassName() = delete;                                           \
     ~ClassName() = default;                                         \
                                                                     \
-    void SetValue(LuaScript* lua_script) override {                 \
-      const auto result =                                           \
+    bool StageValue(LuaScript* lua_script) override {               \
+      auto result =                                                 \
           lua_script->GetVariable<CPPType>(key_, var_locations_);   \
       if (!result.first) {                                          \
-        return;                                                     \
+        return false;                                               \
       }                                                             \
-      val_ = result.second;                                         \
+      std::swap(pending_, result.second);                           \
+      return true;                                                  \
+    }                                                               \
+                                                                    \
+    void CommitValue() override { std::swap(val_, pending_); }      \
+                                                                    \
+    std::string GetValueText() const override {                     \
+      return text::ToText(val_);                                    \
+    }                                                               \
+                                                                    \
+    bool SetValueText(const char* begin, const char* end,           \
+                      std::string* error) override {                \
+      return text::FromText(begin, end, &val_, error);              \
+    }                                                               \
+                                                                    \
+    bool StageValueText(const char* begin, const char* end,         \
+                        std::string* error) override {              \
+      CPPType value = GetDefaultValue();                            \
+      if (!text::FromText(begin, end, &value, error)) {             \
+        return false;                                               \
+      }                                                             \
+      std::swap(pending_, value);                                   \
+      return true;                                                  \
+    }                                                               \
+                                                                    \
+    bool CheckValueText(const char* begin, const char* end,         \
+                        std::string* error) const override {        \
+      CPPType value = GetDefaultValue();                            \
+      return text::FromText(begin, end, &value, error);             \
     }                                                               \
                                                                     \
     const CPPType& GetValue() { return this->val_; }                \
@@ -54,6 +86,7 @@
                                                                     \
    private:                                                         \
     CPPType val_;                                                   \
+    CPPType pending_;                                               \
   };                                                                \
   }                                                                 \
   template <>                                                       \
@@ -78,5 +111,21 @@ GENERIC_CLASS(ConfigVector2fList, CVECTOR2FLIST, std::vector<Eigen::Vector2f>,
               {});
 GENERIC_CLASS(ConfigVector3fList, CVECTOR3FLIST, std::vector<Eigen::Vector3f>,
               {});
+GENERIC_CLASS(ConfigStringIntMap, CSTRINGINTMAP, StringIntMap, StringIntMap());
+GENERIC_CLASS(ConfigStringDoubleMap, CSTRINGDOUBLEMAP, StringDoubleMap,
+              StringDoubleMap());
+GENERIC_CLASS(ConfigStringFloatMap, CSTRINGFLOATMAP, StringFloatMap,
+              StringFloatMap());
+GENERIC_CLASS(ConfigStringStringMap, CSTRINGSTRINGMAP, StringStringMap,
+              StringStringMap());
+GENERIC_CLASS(ConfigStringBoolMap, CSTRINGBOOLMAP, StringBoolMap,
+              StringBoolMap());
+GENERIC_CLASS(ConfigIntIntMap, CINTINTMAP, IntIntMap, IntIntMap());
+GENERIC_CLASS(ConfigIntDoubleMap, CINTDOUBLEMAP, IntDoubleMap, IntDoubleMap());
+GENERIC_CLASS(ConfigIntStringMap, CINTSTRINGMAP, IntStringMap, IntStringMap());
+GENERIC_CLASS(ConfigFloatArray, CFLOATARRAY, FloatArray, FloatArray());
+GENERIC_CLASS(ConfigDoubleArray, CDOUBLEARRAY, DoubleArray, DoubleArray());
+GENERIC_CLASS(ConfigIntArray, CINTARRAY, IntArray, IntArray());
+GENERIC_CLASS(ConfigCurve, CCURVE, Curve, Curve());
 
 #endif  // CONFIGREADER_TYPES_CONFIG_FLOAT_H_
\ No newline at end of file
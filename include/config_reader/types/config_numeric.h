@@ -33,14 +33,16 @@
         : TypeInterface(key, Type::EnumName),                           \
           upper_bound_(std::numeric_limits<CPPType>::max()),            \
           lower_bound_(std::numeric_limits<CPPType>::lowest()),         \
-          val_(0) {}                                                    \
+          val_(0),                                                      \
+          pending_(0) {}                                                \
                                                                         \
-    ClassName(const std::string& key, const int& upper_bound,           \
-              const int& lower_bound)                                   \
+    ClassName(const std::string& key, const CPPType& upper_bound,       \
+              const CPPType& lower_bound)                               \
         : TypeInterface(key, Type::EnumName),                           \
           upper_bound_(upper_bound),                                    \
           lower_bound_(lower_bound),                                    \
-          val_(0) {                                                     \
+          val_(0),                                                      \
+          pending_(0) {                                                 \
       if (upper_bound_ < lower_bound_) {                                \
         std::cerr << #ClassName << " upperbound " << upper_bound_       \
                   << " below lowerbound " << lower_bound_ << std::endl; \
@@ -50,30 +52,81 @@
     ClassName() = delete;                                               \
     ~ClassName() = default;                                             \
                                                                         \
-    void SetValue(LuaScript* lua_script) override {                     \
+    bool StageValue(LuaScript* lua_script) override {                   \
       const auto result =                                               \
           lua_script->GetVariable<CPPType>(key_, var_locations_);       \
       if (!result.first) {                                              \
-        return;                                                         \
+        return false;                                                   \
       }                                                                 \
       const CPPType& value = result.second;                             \
       if (value < lower_bound_ || value > upper_bound_) {               \
-        std::cerr << #ClassName << " Value " << value                   \
-                  << " outside bounds; upperbound " << upper_bound_     \
-                  << " below lowerbound " << lower_bound_ << std::endl; \
-        return;                                                         \
+        lua_script->ErrorLog()                                          \
+            << "Error: can't get [" << key_ << "]. Value " << value     \
+            << " outside bounds [" << lower_bound_ << ", "              \
+            << upper_bound_ << "]" << std::endl;                        \
+        return false;                                                   \
+      }                                                                 \
+      pending_ = value;                                                 \
+      return true;                                                      \
+    }                                                                   \
+                                                                        \
+    void CommitValue() override { val_ = pending_; }                    \
+                                                                        \
+    std::string GetValueText() const override {                         \
+      return text::ToText(val_);                                        \
+    }                                                                   \
+                                                                        \
+    bool SetValueText(const char* begin, const char* end,               \
+                      std::string* error) override {                    \
+      CPPType value = 0;                                                \
+      if (!ParseValueText(begin, end, &value, error)) {                 \
+        return false;                                                   \
       }                                                                 \
       val_ = value;                                                     \
+      return true;                                                      \
+    }                                                                   \
+                                                                        \
+    bool StageValueText(const char* begin, const char* end,             \
+                        std::string* error) override {                  \
+      CPPType value = 0;                                                \
+      if (!ParseValueText(begin, end, &value, error)) {                 \
+        return false;                                                   \
+      }                                                                 \
+      pending_ = value;                                                 \
+      return true;                                                      \
+    }                                                                   \
+                                                                        \
+    bool CheckValueText(const char* begin, const char* end,             \
+                        std::string* error) const override {            \
+      CPPType value = 0;                                                \
+      return ParseValueText(begin, end, &value, error);                 \
     }                                                                   \
                                                                         \
     const CPPType& GetValue() { return this->val_; }                    \
+    const CPPType& GetLowerBound() const { return lower_bound_; }       \
+    const CPPType& GetUpperBound() const { return upper_bound_; }       \
                                                                         \
     static Type GetEnumType() { return Type::EnumName; }                \
                                                                         \
    private:                                                             \
+    bool ParseValueText(const char* begin, const char* end,             \
+                        CPPType* value, std::string* error) const {     \
+      if (!text::FromText(begin, end, value, error)) {                  \
+        return false;                                                   \
+      }                                                                 \
+      if (*value < lower_bound_ || *value > upper_bound_) {             \
+        *error = "Value " + std::to_string(*value) +                    \
+                 " outside bounds [" + std::to_string(lower_bound_) +   \
+                 ", " + std::to_string(upper_bound_) + "]";             \
+        return false;                                                   \
+      }                                                                 \
+      return true;                                                      \
+    }                                                                   \
+                                                                        \
     CPPType upper_bound_;                                               \
     CPPType lower_bound_;                                               \
     CPPType val_;                                                       \
+    CPPType pending_;                                                   \
   };                                                                    \
   }                                                                     \
   template <>                                                           \
@@ -0,0 +1,291 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+
+#ifndef CONFIGREADER_TYPES_CONFIG_STRUCT_H_
+#define CONFIGREADER_TYPES_CONFIG_STRUCT_H_
+
+#include <set>
+#include <string>
+
+#include "config_reader/profile.h"
+#include "config_reader/types/type_interface.h"
+#include "config_reader/value_text.h"
+
+// REFLECT_FOR_EACH(m, s, a, b, c) expands to m(s, a) m(s, b) m(s, c), for up
+// to 32 arguments.
+#define REFLECT_EXPAND(x) x
+// clang-format off
+#define REFLECT_NARGS_IMPL(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11,      \
+                           _12, _13, _14, _15, _16, _17, _18, _19, _20,       \
+                           _21, _22, _23, _24, _25, _26, _27, _28, _29,       \
+                           _30, _31, _32, N, ...)                             \
+  N
+#define REFLECT_NARGS(...)                                                    \
+  REFLECT_EXPAND(REFLECT_NARGS_IMPL(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26,  \
+                                    25, 24, 23, 22, 21, 20, 19, 18, 17, 16,   \
+                                    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5,    \
+                                    4, 3, 2, 1))
+// clang-format on
+#define REFLECT_CONCAT_IMPL(a, b) a##b
+#define REFLECT_CONCAT(a, b) REFLECT_CONCAT_IMPL(a, b)
+
+#define REFLECT_FOR_EACH_1(m, s, x) m(s, x)
+#define REFLECT_FOR_EACH_2(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_1(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_3(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_2(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_4(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_3(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_5(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_4(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_6(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_5(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_7(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_6(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_8(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_7(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_9(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_8(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_10(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_9(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_11(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_10(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_12(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_11(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_13(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_12(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_14(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_13(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_15(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_14(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_16(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_15(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_17(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_16(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_18(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_17(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_19(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_18(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_20(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_19(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_21(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_20(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_22(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_21(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_23(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_22(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_24(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_23(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_25(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_24(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_26(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_25(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_27(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_26(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_28(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_27(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_29(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_28(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_30(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_29(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_31(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_30(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH_32(m, s, x, ...) \
+  m(s, x) REFLECT_EXPAND(REFLECT_FOR_EACH_31(m, s, __VA_ARGS__))
+#define REFLECT_FOR_EACH(m, s, ...)                                  \
+  REFLECT_EXPAND(REFLECT_CONCAT(REFLECT_FOR_EACH_,                     \
+                                REFLECT_NARGS(__VA_ARGS__))(m, s, __VA_ARGS__))
+
+// Reads one field of the table on top of the Lua stack into the struct.
+#define REFLECT_GET_FIELD(data, field) \
+  GetField(variable_name, #field, &data.field);
+
+// Appends one member to the text form of the struct.
+#define REFLECT_WRITE_FIELD(value, field)                        \
+  out->append(first ? #field " = " : ", " #field " = ");         \
+  first = false;                                                 \
+  Codec<decltype(value.field)>::Write(value.field, out);
+
+// Parses one member from the text form if it matches the current key.
+#define REFLECT_READ_FIELD(data, field)                          \
+  if (!known && key.name == #field) {                            \
+    known = true;                                                \
+    ok = Codec<decltype(data.field)>::Read(parser, &data.field); \
+  }
+
+// Declares one member as a ProfiledRef counting reads against the site of
+// the whole struct.
+#define REFLECT_PROFILED_FIELD(CPPType, field)                      \
+  ProfiledRef<decltype(CPPType::field)> field{profiled_value_.field, \
+                                              profiled_site_};
+
+// Makes the struct CPPType loadable from a Lua table whose keys are the listed
+// member names, e.g.
+//
+//   struct Gains { double kp; double ki; };
+//   REFLECT_CONFIG_STRUCT(Gains, kp, ki);
+//   CONFIG_STRUCT(gains, "controller.gains", Gains);
+//
+// Members may be of any supported type, including other reflected structs.
+// Must be used at global scope, like GENERIC_CLASS.
+#define REFLECT_CONFIG_STRUCT(CPPType, ...)                                 \
+  namespace config_reader {                                                 \
+  template <>                                                               \
+  inline CPPType GetDefaultValue<CPPType>() {                               \
+    return CPPType();                                                       \
+  }                                                                         \
+                                                                            \
+  template <>                                                               \
+  inline CPPType LuaScript::Get<CPPType>(const std::string& variable_name) { \
+    CPPType data = GetDefault<CPPType>();                                   \
+    if (!lua_istable(lua_state_, -1)) {                                     \
+      Error(variable_name, "Not a " #CPPType " table");                     \
+      return data;                                                          \
+    }                                                                       \
+    REFLECT_FOR_EACH(REFLECT_GET_FIELD, data, __VA_ARGS__)                  \
+    return data;                                                            \
+  }                                                                         \
+                                                                            \
+  namespace text {                                                          \
+  template <>                                                               \
+  struct Codec<CPPType> {                                                   \
+    static void Write(const CPPType& value, std::string* out) {            \
+      bool first = true;                                                    \
+      out->push_back('{');                                                  \
+      REFLECT_FOR_EACH(REFLECT_WRITE_FIELD, value, __VA_ARGS__)             \
+      out->push_back('}');                                                  \
+    }                                                                       \
+                                                                            \
+    /* Like the Lua path, every member must be present. */                  \
+    static bool Read(Parser* parser, CPPType* value) {                      \
+      CPPType data = GetDefaultValue<CPPType>();                            \
+      std::set<std::string> seen;                                           \
+      if (!parser->Expect('{')) {                                           \
+        return false;                                                       \
+      }                                                                     \
+      while (!parser->Consume('}')) {                                       \
+        Parser::Key key;                                                    \
+        if (parser->AtEnd()) {                                              \
+          return parser->Fail("Unterminated table");                        \
+        }                                                                   \
+        if (!parser->ParseKey(&key)) {                                      \
+          return false;                                                     \
+        }                                                                   \
+        bool known = false;                                                 \
+        bool ok = true;                                                     \
+        if (key.kind == Parser::kString) {                                  \
+          REFLECT_FOR_EACH(REFLECT_READ_FIELD, data, __VA_ARGS__)           \
+        }                                                                   \
+        if (!(known ? ok : parser->SkipValue())) {                          \
+          return false;                                                     \
+        }                                                                   \
+        if (known) {                                                        \
+          seen.insert(key.name);                                            \
+        }                                                                   \
+        parser->ConsumeSeparator();                                         \
+      }                                                                     \
+      if (seen.size() != REFLECT_NARGS(__VA_ARGS__)) {                      \
+        return parser->Fail("Missing members of " #CPPType);                \
+      }                                                                     \
+      *value = data;                                                        \
+      return true;                                                          \
+    }                                                                       \
+  };                                                                        \
+  }                                                                         \
+                                                                            \
+  /* So that members can be read with . under CONFIG_READER_PROFILE. */     \
+  template <>                                                               \
+  class ProfiledFields<CPPType> {                                           \
+    const CPPType& profiled_value_;                                         \
+    profile::Site* const profiled_site_;                                    \
+                                                                            \
+   public:                                                                  \
+    ProfiledFields(const CPPType& value, profile::Site* site)               \
+        : profiled_value_(value), profiled_site_(site) {}                   \
+    REFLECT_FOR_EACH(REFLECT_PROFILED_FIELD, CPPType, __VA_ARGS__)          \
+  };                                                                        \
+  }
+
+namespace config_reader {
+namespace config_types {
+
+// A whole Lua table bound to one C++ struct. The table is resolved with a
+// single path lookup and all members are read in one pass; the stored struct
+// is only replaced if every member was read successfully.
+template <typename CPPType>
+class ConfigStruct : public TypeInterface {
+ public:
+  ConfigStruct(const std::string& key)
+      : TypeInterface(key, Type::CSTRUCT),
+        val_(GetDefaultValue<CPPType>()),
+        pending_(GetDefaultValue<CPPType>()) {}
+
+  ConfigStruct() = delete;
+  ~ConfigStruct() = default;
+
+  bool StageValue(LuaScript* lua_script) override {
+    auto result = lua_script->GetVariable<CPPType>(key_, var_locations_);
+    if (!result.first) {
+      return false;
+    }
+    std::swap(pending_, result.second);
+    return true;
+  }
+
+  void CommitValue() override { std::swap(val_, pending_); }
+
+  std::string GetValueText() const override { return text::ToText(val_); }
+
+  bool SetValueText(const char* begin, const char* end,
+                    std::string* error) override {
+    return text::FromText(begin, end, &val_, error);
+  }
+
+  bool StageValueText(const char* begin, const char* end,
+                      std::string* error) override {
+    CPPType value = GetDefaultValue<CPPType>();
+    if (!text::FromText(begin, end, &value, error)) {
+      return false;
+    }
+    std::swap(pending_, value);
+    return true;
+  }
+
+  bool CheckValueText(const char* begin, const char* end,
+                      std::string* error) const override {
+    CPPType value = GetDefaultValue<CPPType>();
+    return text::FromText(begin, end, &value, error);
+  }
+
+  const CPPType& GetValue() { return this->val_; }
+
+  static Type GetEnumType() { return Type::CSTRUCT; }
+
+ private:
+  CPPType val_;
+  CPPType pending_;
+};
+
+}  // namespace config_types
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_TYPES_CONFIG_STRUCT_H_
@@ -27,6 +27,7 @@
 #include <vector>
 
 #include "config_reader/lua_script.h"
+#include "config_reader/value_text.h"
 
 namespace config_reader {
 namespace config_types {
@@ -49,6 +50,19 @@ enum Type {
   CBOOLLIST,
   CVECTOR2FLIST,
   CVECTOR3FLIST,
+  CSTRUCT,
+  CSTRINGINTMAP,
+  CSTRINGDOUBLEMAP,
+  CSTRINGFLOATMAP,
+  CSTRINGSTRINGMAP,
+  CSTRINGBOOLMAP,
+  CINTINTMAP,
+  CINTDOUBLEMAP,
+  CINTSTRINGMAP,
+  CFLOATARRAY,
+  CDOUBLEARRAY,
+  CINTARRAY,
+  CCURVE,
 };
 
 class TypeInterface {
@@ -62,9 +76,37 @@ class TypeInterface {
   virtual ~TypeInterface() {}
   std::string GetKey() const { return key_; };
   Type GetType() const { return type_; };
-  virtual void SetValue(LuaScript* lua_script) = 0;
+  // Applies the value from an evaluated script. On error the value is left
+  // unchanged.
+  void SetValue(LuaScript* lua_script) {
+    if (StageValue(lua_script)) {
+      CommitValue();
+    }
+  }
+  // Reads the value from an evaluated script into a pending slot, leaving
+  // the current value alone. Returns false, staging nothing, on error.
+  virtual bool StageValue(LuaScript* lua_script) = 0;
+  // Makes the value staged by the last successful StageValue current. It
+  // swaps rather than copies, so must be called once per staged value.
+  virtual void CommitValue() = 0;
+  // The current value in Lua literal syntax, see value_text.h.
+  virtual std::string GetValueText() const = 0;
+  // Applies a value in Lua literal syntax with the same checks as SetValue.
+  // On failure the value is unchanged and *error says why.
+  virtual bool SetValueText(const char* begin, const char* end,
+                            std::string* error) = 0;
+  // Like SetValueText, but stages the value as StageValue does, for a later
+  // CommitValue().
+  virtual bool StageValueText(const char* begin, const char* end,
+                              std::string* error) = 0;
+  // Like SetValueText, but only reports whether the value would be accepted.
+  virtual bool CheckValueText(const char* begin, const char* end,
+                              std::string* error) const = 0;
 
   void AddVarLocation(const std::string& l) { var_locations_.push_back(l); }
+  const std::vector<std::string>& GetVarLocations() const {
+    return var_locations_;
+  }
 
  protected:
   std::string key_;
@@ -0,0 +1,447 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_VALIDATION_H_
+#define CONFIGREADER_VALIDATION_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config_reader/chunk_cache.h"
+#include "config_reader/lua_script.h"
+#include "config_reader/macros.h"
+
+namespace config_reader {
+
+// A key that a config must define, the type its value must convert to and,
+// for the numeric types, the range it must lie in.
+struct SchemaEntry {
+  std::string key;
+  config_types::Type type;
+  bool bounded;
+  double lower;
+  double upper;
+
+  SchemaEntry()
+      : type(config_types::CNULL), bounded(false), lower(0), upper(0) {}
+  SchemaEntry(const std::string& key, const config_types::Type type)
+      : key(key), type(type), bounded(false), lower(0), upper(0) {}
+};
+
+// The outcome of validating one config.
+struct ValidationResult {
+  // The config's own file, evaluated after any common files.
+  std::string file;
+  bool loaded;
+  // The messages LuaRead() would print, one per line. Warnings, e.g. that
+  // the backend can't limit memory use, don't fail the config.
+  std::vector<std::string> errors;
+  std::vector<std::string> warnings;
+  // Time to evaluate the files, and to convert and check every key.
+  double load_ms;
+  double check_ms;
+
+  ValidationResult() : loaded(false), load_ms(0), check_ms(0) {}
+  bool ok() const { return loaded && errors.empty(); }
+};
+
+namespace schema {
+
+struct NamedType {
+  config_types::Type type;
+  const char* name;
+};
+
+// The schema's name for each type: the suffix of its CONFIG_* macro.
+static constexpr NamedType kTypeNames[] = {
+    {config_types::CINT, "int"},
+    {config_types::CUINT, "uint"},
+    {config_types::CDOUBLE, "double"},
+    {config_types::CFLOAT, "float"},
+    {config_types::CSTRING, "string"},
+    {config_types::CBOOL, "bool"},
+    {config_types::CINTLIST, "intlist"},
+    {config_types::CUINTLIST, "uintlist"},
+    {config_types::CFLOATLIST, "floatlist"},
+    {config_types::CDOUBLELIST, "doublelist"},
+    {config_types::CSTRINGLIST, "stringlist"},
+    {config_types::CBOOLLIST, "boollist"},
+    {config_types::CVECTOR2F, "vector2f"},
+    {config_types::CVECTOR3F, "vector3f"},
+    {config_types::CVECTOR2FLIST, "vector2flist"},
+    {config_types::CVECTOR3FLIST, "vector3flist"},
+    {config_types::CSTRINGINTMAP, "stringintmap"},
+    {config_types::CSTRINGDOUBLEMAP, "stringdoublemap"},
+    {config_types::CSTRINGFLOATMAP, "stringfloatmap"},
+    {config_types::CSTRINGSTRINGMAP, "stringstringmap"},
+    {config_types::CSTRINGBOOLMAP, "stringboolmap"},
+    {config_types::CINTINTMAP, "intintmap"},
+    {config_types::CINTDOUBLEMAP, "intdoublemap"},
+    {config_types::CINTSTRINGMAP, "intstringmap"},
+    {config_types::CFLOATARRAY, "floatarray"},
+    {config_types::CDOUBLEARRAY, "doublearray"},
+    {config_types::CINTARRAY, "intarray"},
+    {config_types::CCURVE, "curve"},
+};
+
+inline const char* TypeName(const config_types::Type type) {
+  for (const NamedType& named : kTypeNames) {
+    if (named.type == type) {
+      return named.name;
+    }
+  }
+  return nullptr;
+}
+
+inline bool ParseType(const std::string& name, config_types::Type* type) {
+  for (const NamedType& named : kTypeNames) {
+    if (name == named.name) {
+      *type = named.type;
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename ConfigType>
+void GetBounds(const config_types::TypeInterface& variable,
+               SchemaEntry* entry) {
+  using CPPType = ConfigValueType<ConfigType>;
+  const ConfigType* numeric = dynamic_cast<const ConfigType*>(&variable);
+  if (numeric == nullptr) {
+    return;
+  }
+  entry->bounded =
+      numeric->GetLowerBound() != std::numeric_limits<CPPType>::lowest() ||
+      numeric->GetUpperBound() != std::numeric_limits<CPPType>::max();
+  entry->lower = numeric->GetLowerBound();
+  entry->upper = numeric->GetUpperBound();
+}
+
+// Whether both bounds are values of the variable's type, as MakeNumeric()
+// needs to convert them.
+template <typename ConfigType>
+bool BoundsFit(const std::string& lower, const std::string& upper) {
+  ConfigValueType<ConfigType> value;
+  std::string error;
+  return text::FromText(lower, &value, &error) &&
+         text::FromText(upper, &value, &error);
+}
+
+// Whether an entry's bounds, as written in a schema, suit its type.
+inline bool BoundsFit(const config_types::Type type, const std::string& lower,
+                      const std::string& upper) {
+  switch (type) {
+    case config_types::CINT:
+      return BoundsFit<config_types::ConfigInt>(lower, upper);
+    case config_types::CUINT:
+      return BoundsFit<config_types::ConfigUnsignedInt>(lower, upper);
+    case config_types::CDOUBLE:
+      return BoundsFit<config_types::ConfigDouble>(lower, upper);
+    case config_types::CFLOAT:
+      return BoundsFit<config_types::ConfigFloat>(lower, upper);
+    default:
+      return false;
+  }
+}
+
+template <typename ConfigType>
+std::unique_ptr<config_types::TypeInterface> MakeNumeric(
+    const SchemaEntry& entry) {
+  using CPPType = ConfigValueType<ConfigType>;
+  if (!entry.bounded) {
+    return std::unique_ptr<config_types::TypeInterface>(
+        new ConfigType(entry.key));
+  }
+  return std::unique_ptr<config_types::TypeInterface>(
+      new ConfigType(entry.key, static_cast<CPPType>(entry.upper),
+                     static_cast<CPPType>(entry.lower)));
+}
+
+// A variable of the entry's type, not bound in any registry, which reads and
+// checks its value exactly as one declared with the CONFIG_* macro does.
+// Null for types the schema can't name.
+inline std::unique_ptr<config_types::TypeInterface> MakeVariable(
+    const SchemaEntry& entry) {
+  using namespace config_types;
+  using Variable = std::unique_ptr<TypeInterface>;
+  switch (entry.type) {
+    case CINT:
+      return MakeNumeric<ConfigInt>(entry);
+    case CUINT:
+      return MakeNumeric<ConfigUnsignedInt>(entry);
+    case CDOUBLE:
+      return MakeNumeric<ConfigDouble>(entry);
+    case CFLOAT:
+      return MakeNumeric<ConfigFloat>(entry);
+    case CSTRING:
+      return Variable(new ConfigString(entry.key));
+    case CBOOL:
+      return Variable(new ConfigBool(entry.key));
+    case CINTLIST:
+      return Variable(new ConfigIntList(entry.key));
+    case CUINTLIST:
+      return Variable(new ConfigUnsignedIntList(entry.key));
+    case CFLOATLIST:
+      return Variable(new ConfigFloatList(entry.key));
+    case CDOUBLELIST:
+      return Variable(new ConfigDoubleList(entry.key));
+    case CSTRINGLIST:
+      return Variable(new ConfigStringList(entry.key));
+    case CBOOLLIST:
+      return Variable(new ConfigBoolList(entry.key));
+    case CVECTOR2F:
+      return Variable(new ConfigVector2f(entry.key));
+    case CVECTOR3F:
+      return Variable(new ConfigVector3f(entry.key));
+    case CVECTOR2FLIST:
+      return Variable(new ConfigVector2fList(entry.key));
+    case CVECTOR3FLIST:
+      return Variable(new ConfigVector3fList(entry.key));
+    case CSTRINGINTMAP:
+      return Variable(new ConfigStringIntMap(entry.key));
+    case CSTRINGDOUBLEMAP:
+      return Variable(new ConfigStringDoubleMap(entry.key));
+    case CSTRINGFLOATMAP:
+      return Variable(new ConfigStringFloatMap(entry.key));
+    case CSTRINGSTRINGMAP:
+      return Variable(new ConfigStringStringMap(entry.key));
+    case CSTRINGBOOLMAP:
+      return Variable(new ConfigStringBoolMap(entry.key));
+    case CINTINTMAP:
+      return Variable(new ConfigIntIntMap(entry.key));
+    case CINTDOUBLEMAP:
+      return Variable(new ConfigIntDoubleMap(entry.key));
+    case CINTSTRINGMAP:
+      return Variable(new ConfigIntStringMap(entry.key));
+    case CFLOATARRAY:
+      return Variable(new ConfigFloatArray(entry.key));
+    case CDOUBLEARRAY:
+      return Variable(new ConfigDoubleArray(entry.key));
+    case CINTARRAY:
+      return Variable(new ConfigIntArray(entry.key));
+    case CCURVE:
+      return Variable(new ConfigCurve(entry.key));
+    default:
+      return nullptr;
+  }
+}
+
+// Sorts the script's messages into errors and warnings.
+inline void SplitMessages(const std::string& text, ValidationResult* result) {
+  std::istringstream stream(text);
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (line.compare(0, 9, "Warning: ") == 0) {
+      result->warnings.push_back(line);
+    } else if (!line.empty()) {
+      result->errors.push_back(line);
+    }
+  }
+}
+
+}  // namespace schema
+
+// The keys bound in `registry`, sorted. Struct keys are left out, since a
+// struct's fields are only known to the program that declares it.
+inline std::vector<SchemaEntry> ExportSchema(
+    Registry* registry = &Registry::Default()) {
+  using namespace config_types;
+  std::vector<SchemaEntry> entries;
+  for (const auto& key : registry->Keys()) {
+    const TypeInterface& variable = *key.second;
+    if (schema::TypeName(variable.GetType()) == nullptr) {
+      continue;
+    }
+    SchemaEntry entry(key.first, variable.GetType());
+    switch (variable.GetType()) {
+      case CINT:
+        schema::GetBounds<ConfigInt>(variable, &entry);
+        break;
+      case CUINT:
+        schema::GetBounds<ConfigUnsignedInt>(variable, &entry);
+        break;
+      case CDOUBLE:
+        schema::GetBounds<ConfigDouble>(variable, &entry);
+        break;
+      case CFLOAT:
+        schema::GetBounds<ConfigFloat>(variable, &entry);
+        break;
+      default:
+        break;
+    }
+    entries.push_back(entry);
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const SchemaEntry& a, const SchemaEntry& b) {
+              return a.key < b.key;
+            });
+  return entries;
+}
+
+// One `key type` line per entry, followed by `lower upper` for bounded
+// numbers, e.g. `pid.kp double 0 10`.
+inline std::string WriteSchema(const std::vector<SchemaEntry>& entries) {
+  std::string text;
+  for (const SchemaEntry& entry : entries) {
+    text += entry.key + " " + schema::TypeName(entry.type);
+    if (entry.bounded) {
+      text += " " + text::ToText(entry.lower) + " " +
+              text::ToText(entry.upper);
+    }
+    text += "\n";
+  }
+  return text;
+}
+
+// Reads the output of WriteSchema(). Blank lines and lines starting with #
+// are skipped. On failure *error names the offending line.
+inline bool ReadSchema(const std::string& text,
+                       std::vector<SchemaEntry>* entries, std::string* error) {
+  entries->clear();
+  std::istringstream lines(text);
+  std::string line;
+  for (int number = 1; std::getline(lines, line); ++number) {
+    std::istringstream fields(line);
+    std::string key;
+    std::string type;
+    if (!(fields >> key) || key[0] == '#') {
+      continue;
+    }
+    const std::string where = "line " + std::to_string(number) + ": ";
+    SchemaEntry entry;
+    entry.key = key;
+    if (!(fields >> type) || !schema::ParseType(type, &entry.type)) {
+      *error = where + "unknown type '" + type + "'";
+      return false;
+    }
+    std::string lower;
+    std::string upper;
+    if (fields >> lower) {
+      const bool numeric =
+          entry.type == config_types::CINT ||
+          entry.type == config_types::CUINT ||
+          entry.type == config_types::CDOUBLE ||
+          entry.type == config_types::CFLOAT;
+      std::string extra;
+      if (!numeric || !(fields >> upper) || fields >> extra ||
+          !text::FromText(lower, &entry.lower, error) ||
+          !text::FromText(upper, &entry.upper, error)) {
+        *error = where + "bounds need a numeric type and two numbers";
+        return false;
+      }
+      if (!schema::BoundsFit(entry.type, lower, upper)) {
+        *error = where + "bounds " + lower + " " + upper + " don't fit type '" +
+                 type + "'";
+        return false;
+      }
+      if (!(entry.lower <= entry.upper)) {
+        *error = where + "lower bound " + lower + " is above upper bound " +
+                 upper;
+        return false;
+      }
+      entry.bounded = true;
+    }
+    entries->push_back(entry);
+  }
+  return true;
+}
+
+// Evaluates `common` followed by `file`, as a program reading those files
+// would, and reads every key of the schema with the same conversion and
+// bounds checks as LuaRead(). Undefined keys count as errors. Safe to call
+// from several threads; scripts given the same `chunks` parse the files
+// they share once.
+inline ValidationResult ValidateConfig(
+    const std::vector<SchemaEntry>& entries,
+    const std::vector<std::string>& common, const std::string& file,
+    const ScriptLimits& limits = ScriptLimits(),
+    std::shared_ptr<ChunkCache> chunks = nullptr) {
+  ValidationResult result;
+  result.file = file;
+  std::vector<std::string> files = common;
+  files.push_back(file);
+  std::ostringstream log;
+  const auto start = std::chrono::steady_clock::now();
+  LuaScript script(files, limits, std::move(chunks), &log);
+  const auto loaded = std::chrono::steady_clock::now();
+  result.load_ms =
+      std::chrono::duration<double, std::milli>(loaded - start).count();
+  result.loaded = script.IsLoaded();
+  if (result.loaded) {
+    for (const SchemaEntry& entry : entries) {
+      const std::unique_ptr<config_types::TypeInterface> variable =
+          schema::MakeVariable(entry);
+      const std::streampos logged = log.tellp();
+      if (variable != nullptr && !variable->StageValue(&script) &&
+          log.tellp() == logged) {
+        log << "Error: can't get [" << entry.key << "]. Not defined"
+            << std::endl;
+      }
+    }
+  }
+  result.check_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - loaded)
+                        .count();
+  schema::SplitMessages(log.str(), &result);
+  return result;
+}
+
+// Validates each of `files` on its own, after `common`, on `threads`
+// threads, or one per core if 0. Results are in the order of `files`.
+inline std::vector<ValidationResult> ValidateConfigs(
+    const std::vector<SchemaEntry>& entries,
+    const std::vector<std::string>& common,
+    const std::vector<std::string>& files,
+    const ScriptLimits& limits = ScriptLimits(), size_t threads = 0) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, files.size());
+  std::vector<ValidationResult> results(files.size());
+  const auto chunks = std::make_shared<ChunkCache>();
+  std::atomic<size_t> next(0);
+  const auto work = [&]() {
+    for (size_t i = next++; i < files.size(); i = next++) {
+      results[i] = ValidateConfig(entries, common, files[i], limits, chunks);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; ++i) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  return results;
+}
+
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_VALIDATION_H_
@@ -0,0 +1,807 @@
+// Copyright 2019 - 2020 Kyle Vedder (kvedder@seas.upenn.edu),
+// 2018 Ishan Khatri (ikhatri@umass.edu)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+// ========================================================================
+#ifndef CONFIGREADER_VALUE_TEXT_H_
+#define CONFIGREADER_VALUE_TEXT_H_
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <eigen3/Eigen/Core>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "config_reader/curve.h"
+#include "config_reader/flat_map.h"
+#include "config_reader/mapped_array.h"
+
+// Conversion of config values to and from text in Lua literal syntax, e.g.
+// `{kp = 1.5, limits = {-1, 1}}`. Used wherever values are moved around
+// without evaluating Lua: snapshots, live overrides and exports.
+namespace config_reader {
+namespace text {
+
+// Deepest nesting of tables the parser accepts. Parsing recurses into each
+// table, and text from an override socket mustn't overflow the stack.
+static constexpr int kMaxNesting = 64;
+
+// Reads a subset of Lua literal syntax: numbers, strings, booleans, nil and
+// table constructors, plus `--` comments.
+class Parser {
+  const char* pos_;
+  const char* end_;
+  std::string error_;
+  int depth_;
+
+  static bool IsNameStart(const char c) {
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+  }
+  static bool IsNameChar(const char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+  }
+
+ public:
+  enum KeyKind { kPositional, kString, kNumber };
+
+  // Key of a table entry; positional entries have no key.
+  struct Key {
+    KeyKind kind;
+    std::string name;
+    double number;
+  };
+
+  Parser(const char* begin, const char* end)
+      : pos_(begin), end_(end), depth_(0) {}
+  explicit Parser(const std::string& text)
+      : pos_(text.data()), end_(text.data() + text.size()), depth_(0) {}
+
+  const char* position() const { return pos_; }
+  const std::string& error() const { return error_; }
+
+  // Records the first failure only, which is the most useful one.
+  bool Fail(const std::string& message) {
+    if (error_.empty()) {
+      const size_t context = std::min<size_t>(end_ - pos_, 20);
+      error_ = message + " at '" + std::string(pos_, context) + "'";
+    }
+    return false;
+  }
+
+  // Bracket each table that parsing recurses into, failing past kMaxNesting.
+  bool EnterTable() {
+    return ++depth_ <= kMaxNesting || Fail("Tables nested too deeply");
+  }
+  void LeaveTable() { --depth_; }
+
+  void SkipSpace() {
+    while (pos_ < end_) {
+      if (std::isspace(static_cast<unsigned char>(*pos_))) {
+        ++pos_;
+      } else if (*pos_ == '-' && pos_ + 1 < end_ && pos_[1] == '-') {
+        while (pos_ < end_ && *pos_ != '\n') {
+          ++pos_;
+        }
+      } else {
+        break;
+      }
+    }
+  }
+
+  bool AtEnd() {
+    SkipSpace();
+    return pos_ >= end_;
+  }
+
+  bool Consume(const char c) {
+    SkipSpace();
+    if (pos_ < end_ && *pos_ == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  bool Expect(const char c) {
+    return Consume(c) || Fail(std::string("Expected '") + c + "'");
+  }
+
+  // Consumes the separator after a table entry, if any.
+  void ConsumeSeparator() {
+    if (!Consume(',')) {
+      Consume(';');
+    }
+  }
+
+  bool ParseName(std::string* name) {
+    SkipSpace();
+    if (pos_ >= end_ || !IsNameStart(*pos_)) {
+      return Fail("Expected a name");
+    }
+    const char* start = pos_;
+    while (pos_ < end_ && IsNameChar(*pos_)) {
+      ++pos_;
+    }
+    name->assign(start, pos_);
+    return true;
+  }
+
+  bool ParseNumber(double* value) {
+    SkipSpace();
+    const char* start = pos_;
+    while (pos_ < end_ && (std::isalnum(static_cast<unsigned char>(*pos_)) ||
+                           *pos_ == '.' || *pos_ == '+' || *pos_ == '-')) {
+      ++pos_;
+    }
+    // strtod needs a terminated string.
+    const std::string token(start, pos_);
+    char* parsed_end = nullptr;
+    *value = strtod(token.c_str(), &parsed_end);
+    if (token.empty() || *parsed_end != '\0') {
+      pos_ = start;
+      return Fail("Expected a number");
+    }
+    return true;
+  }
+
+  bool ParseBool(bool* value) {
+    const char* start = pos_;
+    std::string name;
+    if (ParseName(&name)) {
+      if (name == "true" || name == "false") {
+        *value = (name == "true");
+        return true;
+      }
+      pos_ = start;
+    }
+    return Fail("Expected a boolean");
+  }
+
+  bool ParseString(std::string* value) {
+    SkipSpace();
+    if (pos_ >= end_ || (*pos_ != '"' && *pos_ != '\'')) {
+      return Fail("Expected a string");
+    }
+    const char quote = *pos_++;
+    value->clear();
+    while (pos_ < end_ && *pos_ != quote) {
+      char c = *pos_++;
+      if (c == '\\') {
+        if (pos_ >= end_) {
+          break;
+        }
+        c = *pos_++;
+        switch (c) {
+          case 'a': c = '\a'; break;
+          case 'b': c = '\b'; break;
+          case 'f': c = '\f'; break;
+          case 'n': c = '\n'; break;
+          case 'r': c = '\r'; break;
+          case 't': c = '\t'; break;
+          case 'v': c = '\v'; break;
+          case 'x': {
+            if (end_ - pos_ < 2) {
+              return Fail("Bad escape");
+            }
+            const std::string hex(pos_, 2);
+            c = static_cast<char>(strtol(hex.c_str(), nullptr, 16));
+            pos_ += 2;
+            break;
+          }
+          default:
+            if (std::isdigit(static_cast<unsigned char>(c))) {
+              int code = c - '0';
+              for (int i = 0; i < 2 && pos_ < end_ &&
+                              std::isdigit(static_cast<unsigned char>(*pos_));
+                   ++i) {
+                code = code * 10 + (*pos_++ - '0');
+              }
+              c = static_cast<char>(code);
+            }
+            break;
+        }
+      }
+      value->push_back(c);
+    }
+    if (pos_ >= end_) {
+      return Fail("Unterminated string");
+    }
+    ++pos_;
+    return true;
+  }
+
+  // Parses the key of a table entry up to and including the '=', if the
+  // entry has one: `name =`, `["name"] =` or `[3] =`.
+  bool ParseKey(Key* key) {
+    SkipSpace();
+    key->kind = kPositional;
+    if (pos_ < end_ && *pos_ == '[') {
+      ++pos_;
+      SkipSpace();
+      if (pos_ < end_ && (*pos_ == '"' || *pos_ == '\'')) {
+        key->kind = kString;
+        if (!ParseString(&key->name)) {
+          return false;
+        }
+      } else {
+        key->kind = kNumber;
+        if (!ParseNumber(&key->number)) {
+          return false;
+        }
+      }
+      return Expect(']') && Expect('=');
+    }
+    if (pos_ < end_ && IsNameStart(*pos_)) {
+      const char* start = pos_;
+      ParseName(&key->name);
+      SkipSpace();
+      if (pos_ < end_ && *pos_ == '=' && (pos_ + 1 >= end_ || pos_[1] != '=')) {
+        ++pos_;
+        key->kind = kString;
+        return true;
+      }
+      pos_ = start;
+    }
+    return true;
+  }
+
+  bool SkipValue() {
+    SkipSpace();
+    if (pos_ >= end_) {
+      return Fail("Expected a value");
+    }
+    if (*pos_ == '{') {
+      ++pos_;
+      if (!EnterTable()) {
+        return false;
+      }
+      while (!Consume('}')) {
+        Key key;
+        if (AtEnd()) {
+          return Fail("Unterminated table");
+        }
+        if (!ParseKey(&key) || !SkipValue()) {
+          return false;
+        }
+        ConsumeSeparator();
+      }
+      LeaveTable();
+      return true;
+    }
+    if (*pos_ == '"' || *pos_ == '\'') {
+      std::string value;
+      return ParseString(&value);
+    }
+    if (IsNameStart(*pos_)) {
+      const char* start = pos_;
+      std::string name;
+      ParseName(&name);
+      if (name == "true" || name == "false" || name == "nil") {
+        return true;
+      }
+      pos_ = start;
+      if (name != "inf" && name != "nan") {
+        return Fail("Unexpected name");
+      }
+    }
+    double number;
+    return ParseNumber(&number);
+  }
+};
+
+// Whether `name` can be written as a bare table key.
+inline bool IsName(const std::string& name) {
+  static const char* kKeywords[] = {
+      "and",   "break", "do",     "else", "elseif", "end",   "false",
+      "for",   "function", "goto", "if",   "in",     "local", "nil",
+      "not",   "or",    "repeat", "return", "then", "true",  "until",
+      "while"};
+  if (name.empty() ||
+      !(std::isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_')) {
+    return false;
+  }
+  for (const char& c : name) {
+    if (!(std::isalnum(static_cast<unsigned char>(c)) || c == '_')) {
+      return false;
+    }
+  }
+  for (const char* keyword : kKeywords) {
+    if (name == keyword) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline void WriteString(const std::string& value, std::string* out) {
+  out->push_back('"');
+  for (const char& c : value) {
+    switch (c) {
+      case '"': out->append("\\\""); break;
+      case '\\': out->append("\\\\"); break;
+      case '\n': out->append("\\n"); break;
+      case '\r': out->append("\\r"); break;
+      case '\t': out->append("\\t"); break;
+      default:
+        if (std::iscntrl(static_cast<unsigned char>(c))) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\%03d",
+                   static_cast<unsigned char>(c));
+          out->append(escaped);
+        } else {
+          out->push_back(c);
+        }
+        break;
+    }
+  }
+  out->push_back('"');
+}
+
+// Writes `name = ` or `["name"] = `.
+inline void WriteKey(const std::string& name, std::string* out) {
+  if (IsName(name)) {
+    out->append(name);
+  } else {
+    out->push_back('[');
+    WriteString(name, out);
+    out->push_back(']');
+  }
+  out->append(" = ");
+}
+
+// Shortest representation that reads back as the same value.
+template <typename T>
+inline void WriteNumber(const T& value, std::string* out) {
+  const int kShort = std::is_same<T, float>::value ? 6 : 15;
+  const int kExact = std::is_same<T, float>::value ? 9 : 17;
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.*g", kShort, static_cast<double>(value));
+  if (static_cast<T>(strtod(buffer, nullptr)) != value) {
+    snprintf(buffer, sizeof(buffer), "%.*g", kExact,
+             static_cast<double>(value));
+  }
+  out->append(buffer);
+}
+
+// Codec<T>::Write appends a value, Codec<T>::Read parses one. Class templates
+// rather than overloads so that codecs declared later, e.g. for reflected
+// structs, are found from the container codecs below.
+template <typename T, typename Enable = void>
+struct Codec;
+
+template <typename T>
+struct Codec<T, typename std::enable_if<std::is_arithmetic<T>::value &&
+                                        !std::is_same<T, bool>::value>::type> {
+  static void Write(const T& value, std::string* out) {
+    if (std::is_integral<T>::value) {
+      out->append(std::to_string(value));
+    } else {
+      WriteNumber(value, out);
+    }
+  }
+  // Text comes from outside the process, e.g. the override socket, so
+  // unlike LuaScript::Get an integer must be a whole number, and any number
+  // must fit the type: casting one that doesn't is undefined.
+  static bool Read(Parser* parser, T* value) {
+    double number = 0;
+    if (!parser->ParseNumber(&number)) {
+      return false;
+    }
+    if (std::is_integral<T>::value &&
+        (!std::isfinite(number) || std::floor(number) != number)) {
+      return parser->Fail("Expected an integer");
+    }
+    // max() of a wide integer type rounds up as a double, so compare against
+    // the exact power of two above it instead.
+    const double lowest = static_cast<double>(std::numeric_limits<T>::lowest());
+    const bool too_large =
+        std::is_integral<T>::value
+            ? number >= std::ldexp(1.0, std::numeric_limits<T>::digits)
+            : number > static_cast<double>(std::numeric_limits<T>::max());
+    if (std::isfinite(number) && (number < lowest || too_large)) {
+      return parser->Fail("Number out of range");
+    }
+    *value = static_cast<T>(number);
+    return true;
+  }
+};
+
+template <>
+struct Codec<bool> {
+  static void Write(const bool& value, std::string* out) {
+    out->append(value ? "true" : "false");
+  }
+  static bool Read(Parser* parser, bool* value) {
+    return parser->ParseBool(value);
+  }
+};
+
+template <>
+struct Codec<std::string> {
+  static void Write(const std::string& value, std::string* out) {
+    WriteString(value, out);
+  }
+  static bool Read(Parser* parser, std::string* value) {
+    return parser->ParseString(value);
+  }
+};
+
+template <typename T>
+struct Codec<std::vector<T>> {
+  static void Write(const std::vector<T>& value, std::string* out) {
+    out->push_back('{');
+    for (size_t i = 0; i < value.size(); ++i) {
+      if (i > 0) {
+        out->append(", ");
+      }
+      const T element = value[i];
+      Codec<T>::Write(element, out);
+    }
+    out->push_back('}');
+  }
+  static bool Read(Parser* parser, std::vector<T>* value) {
+    if (!parser->Expect('{')) {
+      return false;
+    }
+    std::vector<T> data;
+    while (!parser->Consume('}')) {
+      Parser::Key key;
+      if (parser->AtEnd()) {
+        return parser->Fail("Unterminated list");
+      }
+      if (!parser->ParseKey(&key)) {
+        return false;
+      }
+      if (key.kind != Parser::kPositional) {
+        return parser->Fail("Expected a list element");
+      }
+      T element = T();
+      if (!Codec<T>::Read(parser, &element)) {
+        return false;
+      }
+      data.push_back(element);
+      parser->ConsumeSeparator();
+    }
+    *value = data;
+    return true;
+  }
+};
+
+template <int N>
+struct Codec<Eigen::Matrix<float, N, 1>> {
+  using Vector = Eigen::Matrix<float, N, 1>;
+  static void Write(const Vector& value, std::string* out) {
+    out->push_back('{');
+    for (int i = 0; i < N; ++i) {
+      if (i > 0) {
+        out->append(", ");
+      }
+      WriteNumber(value(i), out);
+    }
+    out->push_back('}');
+  }
+  static bool Read(Parser* parser, Vector* value) {
+    std::vector<float> elements;
+    if (!Codec<std::vector<float>>::Read(parser, &elements)) {
+      return false;
+    }
+    if (elements.size() != static_cast<size_t>(N)) {
+      return parser->Fail("Wrong number of entries for Vector" +
+                          std::to_string(N) + "f");
+    }
+    for (int i = 0; i < N; ++i) {
+      (*value)(i) = elements[i];
+    }
+    return true;
+  }
+};
+
+template <typename Value>
+struct Codec<FlatMap<std::string, Value>> {
+  static void Write(const FlatMap<std::string, Value>& value,
+                    std::string* out) {
+    out->push_back('{');
+    bool first = true;
+    for (const auto& entry : value) {
+      out->append(first ? "" : ", ");
+      first = false;
+      WriteKey(entry.first, out);
+      Codec<Value>::Write(entry.second, out);
+    }
+    out->push_back('}');
+  }
+  static bool Read(Parser* parser, FlatMap<std::string, Value>* value) {
+    if (!parser->Expect('{')) {
+      return false;
+    }
+    std::vector<std::pair<std::string, Value>> data;
+    while (!parser->Consume('}')) {
+      Parser::Key key;
+      if (parser->AtEnd()) {
+        return parser->Fail("Unterminated map");
+      }
+      if (!parser->ParseKey(&key)) {
+        return false;
+      }
+      if (key.kind != Parser::kString) {
+        return parser->Fail("Key not a std::string");
+      }
+      Value element = Value();
+      if (!Codec<Value>::Read(parser, &element)) {
+        return false;
+      }
+      data.emplace_back(key.name, element);
+      parser->ConsumeSeparator();
+    }
+    *value = FlatMap<std::string, Value>(std::move(data));
+    return true;
+  }
+};
+
+template <typename Value>
+struct Codec<FlatMap<int, Value>> {
+  static void Write(const FlatMap<int, Value>& value, std::string* out) {
+    out->push_back('{');
+    bool first = true;
+    for (const auto& entry : value) {
+      out->append(first ? "[" : ", [");
+      first = false;
+      out->append(std::to_string(entry.first));
+      out->append("] = ");
+      Codec<Value>::Write(entry.second, out);
+    }
+    out->push_back('}');
+  }
+  static bool Read(Parser* parser, FlatMap<int, Value>* value) {
+    if (!parser->Expect('{')) {
+      return false;
+    }
+    std::vector<std::pair<int, Value>> data;
+    while (!parser->Consume('}')) {
+      Parser::Key key;
+      if (parser->AtEnd()) {
+        return parser->Fail("Unterminated map");
+      }
+      if (!parser->ParseKey(&key)) {
+        return false;
+      }
+      if (key.kind != Parser::kNumber ||
+          static_cast<double>(static_cast<int>(key.number)) != key.number) {
+        return parser->Fail("Key not a int");
+      }
+      Value element = Value();
+      if (!Codec<Value>::Read(parser, &element)) {
+        return false;
+      }
+      data.emplace_back(static_cast<int>(key.number), element);
+      parser->ConsumeSeparator();
+    }
+    *value = FlatMap<int, Value>(std::move(data));
+    return true;
+  }
+};
+
+// Written as the file reference, {file = path, shape = {...}}; reading maps
+// the file again.
+template <typename T>
+struct Codec<MappedArray<T>> {
+  static void Write(const MappedArray<T>& value, std::string* out) {
+    out->append("{file = ");
+    WriteString(value.path(), out);
+    out->append(", shape = ");
+    Codec<std::vector<size_t>>::Write(value.shape(), out);
+    out->push_back('}');
+  }
+  static bool Read(Parser* parser, MappedArray<T>* value) {
+    std::string path;
+    std::vector<size_t> shape;
+    if (parser->Consume('{')) {
+      while (!parser->Consume('}')) {
+        Parser::Key key;
+        if (parser->AtEnd()) {
+          return parser->Fail("Unterminated table");
+        }
+        if (!parser->ParseKey(&key)) {
+          return false;
+        }
+        bool ok = true;
+        if (key.kind == Parser::kString && key.name == "file") {
+          ok = parser->ParseString(&path);
+        } else if (key.kind == Parser::kString && key.name == "shape") {
+          ok = Codec<std::vector<size_t>>::Read(parser, &shape);
+        } else {
+          ok = parser->SkipValue();
+        }
+        if (!ok) {
+          return false;
+        }
+        parser->ConsumeSeparator();
+      }
+    } else if (!parser->ParseString(&path)) {
+      return false;
+    }
+    MappedArray<T> data;
+    std::string error;
+    if (!data.Open(path, shape, &error)) {
+      return parser->Fail(error);
+    }
+    *value = data;
+    return true;
+  }
+};
+
+// Written as the samples, {domain = {lower, upper}, values = {...}}, so a
+// curve defined by a Lua function reads back without the function.
+template <>
+struct Codec<Curve> {
+  static void Write(const Curve& value, std::string* out) {
+    out->append("{domain = {");
+    WriteNumber(value.lower(), out);
+    out->append(", ");
+    WriteNumber(value.upper(), out);
+    out->append("}, values = ");
+    Codec<std::vector<float>>::Write(
+        std::vector<float>(value.begin(), value.end()), out);
+    out->push_back('}');
+  }
+  static bool Read(Parser* parser, Curve* value) {
+    std::vector<float> domain;
+    std::vector<float> values;
+    if (!parser->Expect('{')) {
+      return false;
+    }
+    while (!parser->Consume('}')) {
+      Parser::Key key;
+      if (parser->AtEnd()) {
+        return parser->Fail("Unterminated table");
+      }
+      if (!parser->ParseKey(&key)) {
+        return false;
+      }
+      bool ok = true;
+      if (key.kind == Parser::kString && key.name == "domain") {
+        ok = Codec<std::vector<float>>::Read(parser, &domain);
+      } else if (key.kind == Parser::kString && key.name == "values") {
+        ok = Codec<std::vector<float>>::Read(parser, &values);
+      } else {
+        ok = parser->SkipValue();
+      }
+      if (!ok) {
+        return false;
+      }
+      parser->ConsumeSeparator();
+    }
+    if (domain.size() != 2) {
+      return parser->Fail("Curve domain needs {lower, upper}");
+    }
+    Curve data;
+    std::string error;
+    if (!data.Set(domain[0], domain[1], std::move(values), &error)) {
+      return parser->Fail(error);
+    }
+    *value = data;
+    return true;
+  }
+};
+
+template <typename T>
+inline std::string ToText(const T& value) {
+  std::string out;
+  Codec<T>::Write(value, &out);
+  return out;
+}
+
+// Leaves *value untouched on failure.
+template <typename T>
+inline bool FromText(const char* begin, const char* end, T* value,
+                     std::string* error) {
+  Parser parser(begin, end);
+  T data = T();
+  if (!Codec<T>::Read(&parser, &data)) {
+    *error = parser.error();
+    return false;
+  }
+  if (!parser.AtEnd()) {
+    parser.Fail("Unexpected trailing text");
+    *error = parser.error();
+    return false;
+  }
+  *value = data;
+  return true;
+}
+
+template <typename T>
+inline bool FromText(const std::string& text, T* value, std::string* error) {
+  return FromText(text.data(), text.data() + text.size(), value, error);
+}
+
+// Location of the text of each value in a snapshot, keyed by its dotted path
+// as used for config keys, e.g. "tree.stree.number".
+using SnapshotIndex =
+    std::unordered_map<std::string, std::pair<const char*, const char*>>;
+
+inline bool IndexValue(Parser* parser, const std::string& path,
+                       SnapshotIndex* index) {
+  parser->SkipSpace();
+  const char* begin = parser->position();
+  if (parser->Consume('{')) {
+    if (!parser->EnterTable()) {
+      return false;
+    }
+    while (!parser->Consume('}')) {
+      Parser::Key key;
+      if (parser->AtEnd()) {
+        return parser->Fail("Unterminated table");
+      }
+      if (!parser->ParseKey(&key)) {
+        return false;
+      }
+      const bool ok = (key.kind == Parser::kString)
+                          ? IndexValue(parser, path + "." + key.name, index)
+                          : parser->SkipValue();
+      if (!ok) {
+        return false;
+      }
+      parser->ConsumeSeparator();
+    }
+    parser->LeaveTable();
+  } else if (!parser->SkipValue()) {
+    return false;
+  }
+  (*index)[path] = std::make_pair(begin, parser->position());
+  return true;
+}
+
+// Indexes a snapshot, which is a sequence of `name = value` assignments of
+// global variables. The index points into `snapshot`, which must outlive it.
+inline bool IndexSnapshot(const std::string& snapshot, SnapshotIndex* index,
+                          std::string* error) {
+  Parser parser(snapshot);
+  while (!parser.AtEnd()) {
+    Parser::Key key;
+    if (!parser.ParseKey(&key)) {
+      *error = parser.error();
+      return false;
+    }
+    if (key.kind != Parser::kString) {
+      parser.Fail("Expected name = value");
+      *error = parser.error();
+      return false;
+    }
+    if (!IndexValue(&parser, key.name, index)) {
+      *error = parser.error();
+      return false;
+    }
+    parser.Consume(';');
+  }
+  return true;
+}
+
+}  // namespace text
+}  // namespace config_reader
+
+#endif  // CONFIGREADER_VALUE_TEXT_H_